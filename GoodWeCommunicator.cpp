@@ -1,5 +1,6 @@
 #include "GoodWeCommunicator.h"
 
+constexpr uint32_t GoodWeCommunicator::AutoBaudRates[];
 
 GoodWeCommunicator::GoodWeCommunicator(SettingsManager* settingsMan)
 {
@@ -11,9 +12,16 @@ void GoodWeCommunicator::start()
 	auto settings = settingsManager->GetSettings();
 	//create the software serial on the custom pins so we can use the hardware serial for debug comms.
 	goodweSerial = new SoftwareSerial52();
-	//start the software serial with the params (buffersize is larger than default, that's why we cant ue the constructor)	
-	goodweSerial->begin(9600, SWSERIAL_8N1, settings->RS485Rx, settings->RS485Tx, false, BufferSize); //inverter fixed baud rate
+	//start the software serial with the params. The receive buffers are statically sized in SoftwareSerial52.h
+	//with automatic detection start at the first candidate, discovery steps through the others
+	goodweSerial->begin(settings->RS485BaudRate ? settings->RS485BaudRate : AutoBaudRates[0], SWSERIAL_8N1, settings->RS485Rx, settings->RS485Tx, false);
+	autoBaudIndex = 0;
+	autoBaudRunning = false;
+	baudRateDetected = settings->RS485BaudRate != 0;
+	errorsSinceValidPacket = 0;
 	//goodweSerial->enableIntTx(false);
+	//packets are assembled and parsed from the receive event, perform_work fires it when bytes are available
+	goodweSerial->onReceive([this](int available) { checkIncomingData(); });
 	inverters.clear();
 	//set the fixed part of our buffer
 	headerBuffer[0] = 0xAA;
@@ -143,11 +151,27 @@ void GoodWeCommunicator::checkOfflineInverters()
 
 void GoodWeCommunicator::checkIncomingData()
 {
-	if (goodweSerial->available())
+	//read the received bytes, their arrival times and line errors straight from the serial receive buffer, in at most two blocks
+	const uint8_t* incomingBlock;
+	const uint32_t* incomingTimes;
+	const uint8_t* incomingLineErrors;
+	size_t incomingBlockSize;
+	while ((incomingBlockSize = goodweSerial->peekContiguous(incomingBlock, incomingTimes, incomingLineErrors)) > 0)
 	{
-		while (goodweSerial->available() > 0)
+		for (size_t blockPtr = 0; blockPtr < incomingBlockSize; blockPtr++)
 		{
-			byte incomingData = goodweSerial->read();
+			byte incomingData = incomingBlock[blockPtr];
+
+			//a word with a bad stop or parity bit was dropped by the serial right before this byte. The open packet
+			//would then swallow bytes of the next packet, so discard it and wait for a new packet start
+			if (incomingLineErrors[blockPtr])
+			{
+				if (startPacketReceived)
+					debugPrintln("Line error. Discarding packet.");
+				startPacketReceived = false;
+				lastReceivedByte = 0x00;
+				errorsSinceValidPacket += incomingLineErrors[blockPtr];
+			}
 
 			//wait for packet start. if found read until data length  + data. 
 			//set the time we received the data so we can use some kind of timeout
@@ -155,7 +179,7 @@ void GoodWeCommunicator::checkIncomingData()
 			{
 				//packet start received
 				startPacketReceived = true;
-				lastReceived = millis();
+				lastReceived = lastReceivedByteTime;
 				curReceivePtr = 0;
 				numToRead = 0;
 				lastReceivedByte = 0x00; //reset last received for next packet
@@ -187,18 +211,26 @@ void GoodWeCommunicator::checkIncomingData()
 
 			}
 			else if (!startPacketReceived)
+			{
 				lastReceivedByte = incomingData; //keep track of the last incoming byte so we detect the packet start
+				lastReceivedByteTime = incomingTimes[blockPtr];
+			}
 		}
-
-
+		goodweSerial->commitRead(incomingBlockSize);
 	}
+}
+
+void GoodWeCommunicator::checkPacketTimeout()
+{
 	if (startPacketReceived && millis() - lastReceived > PACKET_TIMEOUT) // 0.5 sec timoeut
 	{
 		//there is an open packet timeout. 
 		startPacketReceived = false; //wait for start packet again
+		errorsSinceValidPacket++;
 		debugPrintln("Comms timeout.");
 	}
 }
+
 void GoodWeCommunicator::parseIncomingData(char incomingDataLength) //
 {
 	//first check the crc
@@ -234,6 +266,7 @@ void GoodWeCommunicator::parseIncomingData(char incomingDataLength) //
 	if (!(high == inputBuffer[incomingDataLength - 2] && low == inputBuffer[incomingDataLength - 1]))
 		return;
 	debugPrintln("CRC match.");
+	errorsSinceValidPacket = 0;
 
 	//check the contorl code and function code to see what to do
 	if (inputBuffer[2] == 0x00 && inputBuffer[3] == 0x80)
@@ -268,7 +301,7 @@ void GoodWeCommunicator::handleRegistration(char* serialNumber, char length)
 			debugPrintln((short)inverters[index].address);
 			//found it. Set to unconfirmed and send out the existing address to the inverter
 			inverters[index].addressConfirmed = false;
-			inverters[index].lastSeen = millis();
+			inverters[index].lastSeen = lastReceived;
 			sendAllocateRegisterAddress(serialNumber,(short) inverters[index].address);
 			return;
 		}
@@ -277,7 +310,7 @@ void GoodWeCommunicator::handleRegistration(char* serialNumber, char length)
 	//still here. This a new inverter
 	GoodWeCommunicator::GoodweInverterInformation newInverter;
 	newInverter.addressConfirmed = false;
-	newInverter.lastSeen = millis();
+	newInverter.lastSeen = lastReceived;
 	newInverter.isDTSeries = false; //TODO. Determine if DT series inverter by getting info
 	memset(newInverter.serialNumber, 0, 17);
 	memcpy(newInverter.serialNumber, serialNumber, 16);
@@ -307,7 +340,7 @@ void GoodWeCommunicator::handleRegistrationConfirmation(char address)
 		debugPrintln("Inverter information found in list of inverters.");
 		inverter->addressConfirmed = true;
 		inverter->isOnline = false; //inverter is online, but we first need to get its information
-		inverter->lastSeen = millis();
+		inverter->lastSeen = lastReceived;
 	}
 	else
 	{
@@ -327,11 +360,11 @@ void GoodWeCommunicator::handleIncomingInformation(char address, char dataLength
 	auto inverter = getInverterInfoByAddress(address);
 	if (inverter == nullptr) return;
 
-	if (dataLength < 44) //minimum for non dt series
+	if (dataLength < (inverter->isDTSeries ? 66 : 46)) //up to and including eDay
 		return;
 
-	//data from iniverter, means online
-	inverter->lastSeen = millis();
+	//data from iniverter, means online. Use the time the packet arrived, not when we got round to parsing it
+	inverter->lastSeen = inverter->sampleTime = lastReceived;
 	char dtPtr = 0;
 	inverter->vpv1 = bytesToFloat(data, 10);					dtPtr += 2;
 	inverter->vpv2 = bytesToFloat(data + dtPtr, 10);				dtPtr += 2;
@@ -357,8 +390,26 @@ void GoodWeCommunicator::handleIncomingInformation(char address, char dataLength
 	}
 	inverter->pac = ((unsigned short)(data[dtPtr]) << 8) | (data[dtPtr + 1]);			dtPtr += 2;
 	inverter->workMode = ((unsigned short)(data[dtPtr]) << 8) | (data[dtPtr + 1]);	dtPtr += 2;
-	//TODO: Get the other values too
-	inverter->temp = bytesToFloat(data + dtPtr, 10);		dtPtr += inverter->isDTSeries ? 34 : 26;
+	inverter->temp = bytesToFloat(data + dtPtr, 10);			dtPtr += 2;
+	inverter->errorMessage = bytesToLong(data + dtPtr);		dtPtr += 4;
+	inverter->eTotal = bytesToLong(data + dtPtr) / 10.0f;	dtPtr += 4;
+	inverter->hTotal = bytesToLong(data + dtPtr);			dtPtr += 4;
+	inverter->tempFault = bytesToFloat(data + dtPtr, 10);		dtPtr += 2;
+	inverter->pv1Fault = bytesToFloat(data + dtPtr, 10);		dtPtr += 2;
+	inverter->pv2Fault = bytesToFloat(data + dtPtr, 10);		dtPtr += 2;
+	inverter->line1VFault = bytesToFloat(data + dtPtr, 10);	dtPtr += 2;
+	if (inverter->isDTSeries)
+	{
+		inverter->line2VFault = bytesToFloat(data + dtPtr, 10);	dtPtr += 2;
+		inverter->line3VFault = bytesToFloat(data + dtPtr, 10);	dtPtr += 2;
+	}
+	inverter->line1FFault = bytesToFloat(data + dtPtr, 100);	dtPtr += 2;
+	if (inverter->isDTSeries)
+	{
+		inverter->line2FFault = bytesToFloat(data + dtPtr, 100);	dtPtr += 2;
+		inverter->line3FFault = bytesToFloat(data + dtPtr, 100);	dtPtr += 2;
+	}
+	inverter->gcfiFault = ((uint8_t)data[dtPtr] << 8) | (uint8_t)data[dtPtr + 1];	dtPtr += 2;
 	inverter->eDay = bytesToFloat(data + dtPtr, 10);
 	//isonline is set after first batch of data is set so readers get actual data 
 	//inverter->isOnline = true;
@@ -367,7 +418,13 @@ void GoodWeCommunicator::handleIncomingInformation(char address, char dataLength
 float GoodWeCommunicator::bytesToFloat(char* bt, char factor)
 {
 	//convert two byte to float by converting to short and then dividing it by factor
-	return float(((unsigned short)bt[0] << 8) | bt[1]) / factor;
+	return float(((uint8_t)bt[0] << 8) | (uint8_t)bt[1]) / factor;
+}
+
+unsigned long GoodWeCommunicator::bytesToLong(char* bt)
+{
+	//four bytes, big endian
+	return ((unsigned long)(uint8_t)bt[0] << 24) | ((unsigned long)(uint8_t)bt[1] << 16) | ((unsigned long)(uint8_t)bt[2] << 8) | (uint8_t)bt[3];
 }
 
 void GoodWeCommunicator::askAllInvertersForInformation()
@@ -430,17 +487,73 @@ void GoodWeCommunicator::sendRemoveRegistration(char address)
 	sendData(address, 0x00, 0x02, 0, nullptr);
 }
 
+void GoodWeCommunicator::startAutoBaud()
+{
+	//the inverter only answers a discovery it understood, so the discovery is sent at the next candidate
+	//baud rate each time. The response is measured by the serial to get the exact rate.
+	auto baudRate = AutoBaudRates[autoBaudIndex];
+	autoBaudIndex = (autoBaudIndex + 1) % (sizeof(AutoBaudRates) / sizeof(AutoBaudRates[0]));
+	debugPrint("Trying inverter baud rate: ");
+	debugPrintln(baudRate);
+	goodweSerial->setBaudRate(baudRate);
+	goodweSerial->startAutoBaud();
+	autoBaudRunning = true;
+	//the measurement discards the response, drop any partial packet too
+	startPacketReceived = false;
+}
+
+void GoodWeCommunicator::checkAutoBaud()
+{
+	if (!autoBaudRunning || goodweSerial->autoBaudPending())
+		return;
+
+	autoBaudRunning = false;
+	baudRateDetected = goodweSerial->autoBaudDetected();
+	if (!baudRateDetected)
+	{
+		//the response was too fast or garbled, the next discovery tries the next rate
+		debugPrintln("Baud rate measurement failed.");
+		return;
+	}
+	errorsSinceValidPacket = 0;
+	debugPrint("Detected inverter baud rate: ");
+	debugPrintln(goodweSerial->baudRate());
+	//the response was used for the measurement. Send the discovery again right away
+	lastDiscoverySent = millis() - DISCOVERY_NO_INVERTERS_INTERVAL;
+}
+
+void GoodWeCommunicator::checkBaudRateLost()
+{
+	//a measured rate can be wrong (a glitch measured as a bit) or the inverter can be reconfigured. Only
+	//errors and no valid packet means the rate doesn't match, measure it again. A set rate is kept.
+	if (!baudRateDetected || settingsManager->GetSettings()->RS485BaudRate || errorsSinceValidPacket < AUTOBAUD_RESTART_ERRORS)
+		return;
+
+	debugPrintln("No valid packets at the detected baud rate. Restarting detection.");
+	baudRateDetected = false;
+	autoBaudIndex = 0;
+	errorsSinceValidPacket = 0;
+	forceDiscovery();
+}
+
 void GoodWeCommunicator::handle()
 {
-	//always check for incoming data
-	checkIncomingData();
+	//always run the receive engine. Received bytes are handled by the receive event
+	goodweSerial->perform_work();
+	checkPacketTimeout();
 
 	//check for offline inverters
 	checkOfflineInverters();
 
+	//auto baud measurement of the discovery response done?
+	checkAutoBaud();
+	checkBaudRateLost();
+
 	//discovery every 10 secs.
 	if (millis() - lastDiscoverySent >= (inverters.size() ? DISCOVERY_WITH_ACTIVE_INVERTERS_INTERVAL : DISCOVERY_NO_INVERTERS_INTERVAL))
 	{
+		if (!baudRateDetected)
+			startAutoBaud();
 		sendDiscovery();
 		lastDiscoverySent = millis();
 	}
@@ -449,15 +562,34 @@ void GoodWeCommunicator::handle()
 		askAllInvertersForInformation();
 		lastInfoUpdateSent = millis();
 	}
-	checkIncomingData(); //check again
 }
 
 
-std::vector<GoodWeCommunicator::GoodweInverterInformation> GoodWeCommunicator::getInvertersInfo()
+const std::vector<GoodWeCommunicator::GoodweInverterInformation> & GoodWeCommunicator::getInvertersInfo()
 {
 	return inverters;
 }
 
+bool GoodWeCommunicator::pollInverter(const char * serialNumber)
+{
+	bool found = false;
+	for (char index = 0; index < inverters.size(); ++index)
+	{
+		if (inverters[index].addressConfirmed && (!serialNumber || strcmp(inverters[index].serialNumber, serialNumber) == 0))
+		{
+			askInverterForInformation(inverters[index].address);
+			found = true;
+		}
+	}
+	return found;
+}
+
+void GoodWeCommunicator::forceDiscovery()
+{
+	//sent in the next handle call
+	lastDiscoverySent = millis() - DISCOVERY_WITH_ACTIVE_INVERTERS_INTERVAL;
+}
+
 GoodWeCommunicator::~GoodWeCommunicator()
 {
 }
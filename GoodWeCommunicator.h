@@ -12,6 +12,7 @@
 #define DISCOVERY_NO_INVERTERS_INTERVAL 10000	//10 secs between discovery if not found
 #define DISCOVERY_WITH_ACTIVE_INVERTERS_INTERVAL 300000	//5 minutes if found
 #define INFO_INTERVAL 10000			//get inverter info every ten seconds
+#define AUTOBAUD_RESTART_ERRORS 16	//line errors and packet timeouts without a valid packet in between that restart the baud rate detection
 
 class GoodWeCommunicator
 {
@@ -24,6 +25,7 @@ public:
 		unsigned long lastSeen;		//when was the inverter last seen? If not seen for 30 seconds the inverter is marked offline. 
 		bool isOnline;				//is the inverter online (see above)
 		bool isDTSeries;			//is tri phase inverter (get phase 2, 3 info)
+		unsigned long sampleTime = 0;	//millis() at the arrival of the frame the values below were decoded from
 
 		//inverert info from inverter pdf. Updated by the inverter info command
 		float vpv1=0.0;
@@ -43,8 +45,8 @@ public:
 		short workMode=0;
 		float temp = 0.0;
 		int errorMessage=0;
-		int eTotal=0;
-		int hTotal=0;
+		float eTotal=0.0;			//kWh
+		int hTotal=0;				//hours
 		float tempFault = 0.0;
 		float pv1Fault = 0.0;
 		float pv2Fault = 0.0;
@@ -54,7 +56,7 @@ public:
 		float line1FFault = 0.0;
 		float line2FFault = 0.0;
 		float line3FFault = 0.0;
-		short gcfiFault=0;
+		unsigned short gcfiFault=0;
 		float eDay = 0.0;
 	};
 
@@ -63,7 +65,9 @@ public:
 	void stop();
 	void handle();
 
-	std::vector<GoodweInverterInformation> getInvertersInfo();
+	const std::vector<GoodweInverterInformation> & getInvertersInfo();
+	bool pollInverter(const char * serialNumber);	//ask for information right away. nullptr: all inverters. False if not found
+	void forceDiscovery();
 	~GoodWeCommunicator();
 
 private:
@@ -76,12 +80,21 @@ private:
 	char headerBuffer[7];
 	char inputBuffer[BufferSize];
 	char outputBuffer[BufferSize];
-	unsigned long lastReceived = 0;			//timeout detection
+	unsigned long lastReceived = 0;			//arrival time of the current packet start (timeout detection and sample time)
 	bool startPacketReceived = false;		//start packet marker
 	char lastReceivedByte = 0;				//packet start consist of 2 bytes to test. This holds the previous byte
+	unsigned long lastReceivedByteTime = 0;	//arrival time of lastReceivedByte, as captured by the serial receive interrupt
 	int curReceivePtr = 0;					//the ptr in our OutputBuffer when reading
 	int numToRead = 0;						//number of bytes to read after the header is read.
 
+	//baud rates tried in turn by the discovery when the baud rate is set to automatic (0). Limited to
+	//SWSERIAL52_AUTOBAUD_MAX_RATE, faster rates can't be measured by the serial
+	static constexpr uint32_t AutoBaudRates[] = { 9600, 19200, 38400, 57600, 4800, 2400 };
+	size_t autoBaudIndex = 0;				//next rate of AutoBaudRates to send the discovery at
+	bool autoBaudRunning = false;			//the serial is measuring the baud rate of the discovery response
+	bool baudRateDetected = false;			//baud rate known, either set in the settings or measured
+	uint16_t errorsSinceValidPacket = 0;	//line errors and packet timeouts since the last packet with a matching crc
+
 	unsigned long lastDiscoverySent = 0;	//discovery needs to be sent every 10 secs. 
 	unsigned long lastInfoUpdateSent = 0;	//last info update sent to the registered inverters
 	char lastUsedAddress = 0;				//last used address counter. When overflows will only allocate not used
@@ -91,13 +104,18 @@ private:
 	int sendData(char address, char controlCode, char functionCode, char dataLength, char * data);
 	void debugPrintHex(char cnt);
 	void sendDiscovery();
+	void startAutoBaud();
+	void checkAutoBaud();
+	void checkBaudRateLost();
 	void checkOfflineInverters();
 	void checkIncomingData();
+	void checkPacketTimeout();
 	void parseIncomingData(char dataLength);
 	void handleRegistration(char * serialNumber, char length);
 	void handleRegistrationConfirmation(char address);
 	void handleIncomingInformation(char address, char dataLengthh, char * data);
 	float bytesToFloat(char * bt, char factor);
+	unsigned long bytesToLong(char * bt);
 	void askAllInvertersForInformation();
 	void askInverterForInformation(char address);
 	GoodWeCommunicator::GoodweInverterInformation * getInverterInfoByAddress(char address);
@@ -14,7 +14,7 @@
 
 SettingsManager settingsManager;
 GoodWeCommunicator goodweComms(&settingsManager);
-MQTTPublisher mqqtPublisher(&settingsManager, &goodweComms);
+MQTTPublisher * mqqtPublishers[MQTT_BROKER_COUNT];		//the first broker and the others with a host name, created in setup
 PVOutputPublisher pvoutputPublisher(&settingsManager, &goodweComms);
 WiFiUDP ntpUDP;
 NTPClient timeClient(ntpUDP, NTP_SERVER);
@@ -30,14 +30,19 @@ void setup()
 	//debug settings
 	auto settings = settingsManager.GetSettings();
 	//set settings from heade file
-	settings->mqttHostName = MQTT_HOST_NAME;
-	settings->mqttPort = MQTT_PORT;
-	settings->mqttUserName = MQTT_USER_NAME;
-	settings->mqttPassword = MQTT_PASSWORD;
+	settings->mqttBrokers[0] = { MQTT_HOST_NAME, MQTT_PORT, MQTT_USER_NAME, MQTT_PASSWORD };
+#if MQTT_BROKER_COUNT > 1
+	settings->mqttBrokers[1] = { MQTT_HOST_NAME_2, MQTT_PORT_2, MQTT_USER_NAME_2, MQTT_PASSWORD_2 };
+#endif
 	settings->mqttQuickUpdateInterval = MQTT_QUICK_UPDATE_INTERVAL;
 	settings->mqttRegularUpdateInterval = MQTT_REGULAR_UPDATE_INTERVAL;
+	settings->mqttJsonMode = MQTT_JSON_MODE;
+	settings->mqttBinaryMode = MQTT_BINARY_MODE;
+	settings->mqttMaxAge = MQTT_MAX_AGE;
+	settings->mqttHomeAssistantDiscovery = MQTT_HOME_ASSISTANT_DISCOVERY;
 	settings->pvoutputApiKey = PVOUTPUT_API_KEY;
 	settings->pvoutputSystemId = PVOUTPUT_SYSTEM_ID;
+	settings->pvoutputSystemMap = PVOUTPUT_SYSTEM_MAP;
 	settings->pvoutputUpdateInterval = PVOUTPUT_UPDATE_INTERVAL;
 	settings->wifiHostname = WIFI_HOSTNAME;
 	settings->wifiSSID = WIFI_SSID;
@@ -45,6 +50,7 @@ void setup()
 	settings->timezone = TIMEZONE;
 	settings->RS485Rx = RS485_RX;
 	settings->RS485Tx = RS485_TX;
+	settings->RS485BaudRate = RS485_BAUD_RATE;
 	settings->wifiConnectTimeout = WIFI_CONNECT_TIMEOUT;
 	settings->ntpServer = NTP_SERVER;
 	settings->inverterOfflineDataResetTimeout = INVERTER_OFFLINE_RESET_VALUES_TIMEOUT;
@@ -98,7 +104,15 @@ void setup()
 
 	//ntp client
 	goodweComms.start();
-	mqqtPublisher.start();
+	for (int broker = 0; broker < MQTT_BROKER_COUNT; broker++)
+	{
+		//a publisher takes some kB of heap for its connection and backlog. The first one reports mqtt is disabled,
+		//the other brokers get none when they are not set
+		if (broker > 0 && !settings->mqttBrokers[broker].hostName.length())
+			continue;
+		mqqtPublishers[broker] = new MQTTPublisher(&settingsManager, &goodweComms, broker);
+		mqqtPublishers[broker]->start();
+	}
 	validTimeSet = timeClient.update();
 	timeClient.setTimeOffset(settings->timezone * 60 * 60);
 }
@@ -162,8 +176,13 @@ void loop()
 	yield();
 	goodweComms.handle();
 	yield();
-	mqqtPublisher.handle();
-	yield();
+	for (auto mqqtPublisher : mqqtPublishers)
+	{
+		if (!mqqtPublisher)
+			continue;
+		mqqtPublisher->handle();
+		yield();
+	}
 	//start the pvoutput publisher after the time has been set if it is configured to start
 	if (validTimeSet && pvoutputPublisher.canStart() && !pvoutputPublisher.getIsStarted())
 		pvoutputPublisher.start();
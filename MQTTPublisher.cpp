@@ -1,13 +1,15 @@
 #include "MQTTPublisher.h"
 
-WiFiClient espClient;
-PubSubClient client(espClient);
+char MQTTPublisher::jsonBuffer[MQTT_JSON_BUFFER_SIZE];
+MQTTPublisher::EncodedState MQTTPublisher::encodedState;
 
-MQTTPublisher::MQTTPublisher(SettingsManager* settingsManager, GoodWeCommunicator* goodWe)
+MQTTPublisher::MQTTPublisher(SettingsManager* settingsManager, GoodWeCommunicator* goodWe, int brokerIndex)
+	: client(espClient)
 {
 	randomSeed(micros());
 	mqttSettingsManager = settingsManager;
 	goodweCommunicator = goodWe;
+	this->brokerIndex = brokerIndex;
 }
 
 MQTTPublisher::~MQTTPublisher()
@@ -17,25 +19,146 @@ MQTTPublisher::~MQTTPublisher()
 }
 
 
-bool MQTTPublisher::reconnect()
+bool MQTTPublisher::handleConnection()
 {
-	lastConnectionAttempt = millis();
+	//one step per call, each bounded by its timeout. The rest of the loop keeps running while the broker is unreachable
+	switch (connectState)
+	{
+	case CONNECT_DONE:
+		if (client.connected())
+			return true;
+		debugPrintln("MQTT connection lost.");
+		connectState = CONNECT_IDLE;
+		break;
+	case CONNECT_IDLE:
+		if (millis() - lastConnectionAttempt > RECONNECT_TIMEOUT)
+		{
+			lastConnectionAttempt = millis();
+			debugPrint("Attempting MQTT connection to server: ");
+			debugPrint(broker->hostName);
+			debugPrintln("...");
+			connectState = CONNECT_RESOLVE;
+		}
+		break;
+	case CONNECT_RESOLVE:
+		//an ip address as host name resolves right away
+		if (WiFi.hostByName(broker->hostName.c_str(), brokerAddress, MQTT_DNS_TIMEOUT) == 1)
+			connectState = CONNECT_TCP;
+		else
+		{
+			debugPrintln("MQTT server host name lookup failed.");
+			connectState = CONNECT_IDLE;
+		}
+		break;
+	case CONNECT_TCP:
+		espClient.setTimeout(MQTT_TCP_CONNECT_TIMEOUT);
+		if (!espClient.connect(brokerAddress, broker->port))
+		{
+			debugPrintln("MQTT server not reachable.");
+			connectState = CONNECT_IDLE;
+		}
+		else if (beginSession())
+			connectState = CONNECT_SESSION;
+		else
+		{
+			espClient.stop();
+			connectState = CONNECT_IDLE;
+		}
+		break;
+	case CONNECT_SESSION:
+		connectState = checkSession();
+		//PubSubClient took the presented CONNACK as accepted. Reset it too, else its next connect is skipped
+		if (connectState == CONNECT_IDLE)
+			client.disconnect();
+		return connectState == CONNECT_DONE;
+	}
+	return false;
+}
 
-	debugPrint("Attempting MQTT connection to server: ");
-	debugPrint(mqttSettings->mqttHostName);
-	debugPrintln("...");
+const uint8_t MQTTPublisher::BrokerConnection::Connack[4] = { 0x20, 0x02, 0x00, 0x00 };
 
+void MQTTPublisher::BrokerConnection::presentConnack()
+{
+	//a new session, the broker starts with a packet
+	connackLeft = sizeof(Connack);
+	remaining = 0;
+	lengthShift = 0;
+	packetType = 0;
+	lastAck = 0;
+}
+
+bool MQTTPublisher::BrokerConnection::packetAvailable()
+{
+	//fixed header and remaining length of the next packet, without waiting for more bytes
+	uint8_t header[5];
+	size_t length = peekBytes(header, min(available(), (int)sizeof(header)));
+	uint32_t packetRemaining = 0;
+	for (size_t cnt = 1; cnt < length; cnt++)
+	{
+		packetRemaining |= (uint32_t)(header[cnt] & 0x7f) << (7 * (cnt - 1));
+		if (!(header[cnt] & 0x80))
+			return (uint32_t)available() >= cnt + 1 + packetRemaining;
+	}
+	return false;
+}
+
+uint16_t MQTTPublisher::BrokerConnection::takeAck()
+{
+	auto packetId = lastAck;
+	lastAck = 0;
+	return packetId;
+}
+
+int MQTTPublisher::BrokerConnection::read()
+{
+	if (connackLeft)
+		return Connack[sizeof(Connack) - connackLeft--];
+	int c = WiFiClient::read();
+	if (c < 0)
+		return c;
+
+	//PUBACK: 0x40, remaining length 2, packet id
+	if (!remaining && lengthShift == 0)
+	{
+		packetType = c & 0xf0;
+		lengthShift = 1; //next: remaining length
+	}
+	else if (lengthShift != 0xff)
+	{
+		remaining |= (uint32_t)(c & 0x7f) << (7 * (lengthShift - 1));
+		lengthShift = c & 0x80 ? lengthShift + 1 : 0xff;
+		if (lengthShift == 0xff && !remaining)
+			lengthShift = 0; //no variable header and payload
+	}
+	else
+	{
+		remaining--;
+		if (packetType == 0x40)
+		{
+			ackId = ackId << 8 | c;
+			if (!remaining)
+				lastAck = ackId;
+		}
+		if (!remaining)
+			lengthShift = 0;
+	}
+	return c;
+}
 
+bool MQTTPublisher::beginSession()
+{
 	// Create a random client ID
 	String clientId = "GoodWeLogger-";
 	clientId += String(random(0xffff), HEX);
 
-	// Attempt to connect
+	//PubSubClient uses the open tcp connection and sends the CONNECT. It reads the presented CONNACK, the
+	//answer of the broker is checked by checkSession
+	espClient.presentConnack();
 	bool clientConnected;
-	if (mqttSettings->mqttUserName.length())
+	if (broker->userName.length())
 	{
 		debugPrintln("Using user credientials for authentication.");
-		clientConnected = client.connect(clientId.c_str(), mqttSettings->mqttUserName.c_str(), mqttSettings->mqttPassword.c_str());
+		clientConnected = client.connect(clientId.c_str(), broker->userName.c_str(), broker->password.c_str());
 	}
 	else
 	{
@@ -43,37 +166,70 @@ bool MQTTPublisher::reconnect()
 		clientConnected = client.connect(clientId.c_str());
 	}
 
-	if (clientConnected)
+	if (!clientConnected)
 	{
-		debugPrintln("connected");
-		// Once connected, publish an announcement...
-		client.publish("goodwe", "online");
-
-		return true;
+		debugPrint("failed, rc=");
+		debugPrintln(client.state());
+		return false;
 	}
-	else {
-
+	sessionStart = millis();
+	return true;
+}
 
+MQTTPublisher::ConnectState MQTTPublisher::checkSession()
+{
+	//CONNACK: 0x20, remaining length 2, session present flag, return code
+	if (espClient.available() < 4)
+	{
+		if (millis() - sessionStart < MQTT_SESSION_TIMEOUT)
+			return CONNECT_SESSION;
+		debugPrintln("MQTT server did not answer the CONNECT.");
+		return CONNECT_IDLE;
+	}
+	uint8_t connack[4];
+	for (auto & byte : connack)
+		byte = espClient.read();
+	if (connack[0] != 0x20 || connack[3] != 0)
+	{
 		debugPrint("failed, rc=");
-		debugPrint(client.state());
-
+		debugPrintln(connack[0] == 0x20 ? connack[3] : -1);
+		return CONNECT_IDLE;
 	}
 
-	return false;
+	debugPrintln("connected");
+	// Once connected, publish an announcement...
+	client.publish("goodwe", "online");
+	//runtime control on goodwe/<host>/cmd, from the first broker only. The commands act on the whole logger
+	if (brokerIndex == 0)
+	{
+		snprintf(topicBuffer, sizeof(topicBuffer), "goodwe/%s/cmd", mqttSettings->wifiHostname.c_str());
+		client.subscribe(topicBuffer);
+	}
+	//the broker may have lost the retained discovery configs, send them again
+	discoveryPublished.assign(discoveryPublished.size(), false);
+	discoveryField = 0;
+	return CONNECT_DONE;
 }
 
 
 void MQTTPublisher::start()
 {
 	mqttSettings = mqttSettingsManager->GetSettings();
-	if (mqttSettings->mqttHostName.length() == 0 || mqttSettings->mqttPort == 0)
+	broker = &mqttSettings->mqttBrokers[brokerIndex];
+	if (broker->hostName.length() == 0 || broker->port == 0)
 	{
-		debugPrintln("MQTT disabled. No hostname or port set.");
+		//only the first broker is required
+		if (brokerIndex == 0)
+			debugPrintln("MQTT disabled. No hostname or port set.");
 		return; //not configured
 	}
 	debugPrintln("MQTT enabled. Connecting.");
-	client.setServer(mqttSettings->mqttHostName.c_str(), mqttSettings->mqttPort);
-	reconnect(); //connect right away
+	client.setServer(broker->hostName.c_str(), broker->port);
+	client.setSocketTimeout(MQTT_READ_TIMEOUT);
+	client.setCallback([this](char * topic, uint8_t * payload, unsigned int length) { receiveCommand(payload, length); });
+	//connect right away, the connection is made over the next handle calls
+	connectState = CONNECT_RESOLVE;
+	lastConnectionAttempt = millis();
 	isStarted = true;
 }
 
@@ -87,89 +243,781 @@ void MQTTPublisher::handle()
 	if (!isStarted)
 		return;
 
-	if (!client.connected() && millis() - lastConnectionAttempt > RECONNECT_TIMEOUT) {
-		if (!reconnect()) return;
+	if (!handleConnection())
+	{
+		//broker unreachable. Keep the samples to send them when the connection is back
+		if (millis() - lastSentQuickUpdate > mqttSettings->mqttQuickUpdateInterval)
+		{
+			storeBacklog();
+			lastSentQuickUpdate = millis();
+		}
+		return;
 	}
 
-	//got a valid mqtt connection. Loop through the inverts and send out the data if needed
-	client.loop();
+	//got a valid mqtt connection. Loop through the inverts and send out the data if needed.
+	receivePackets();
+
+	//publishing is spread over the handle calls. Each call stops at the time budget or when the
+	//message rate is used up, so the loop latency does not grow with the number of inverters
+	auto callStart = micros();
+
+	//qos 1 messages without PUBACK, also the ones of before a reconnect
+	retransmitInFlight(callStart);
 
-	bool sendRegular = millis() - lastSentRegularUpdate > mqttSettings->mqttRegularUpdateInterval;
-	bool sendQuick = millis() - lastSentQuickUpdate > mqttSettings->mqttQuickUpdateInterval;
+	//home assistant discovery for the inverters confirmed since the connect. Home assistant can not read the binary samples
+	if (mqttSettings->mqttHomeAssistantDiscovery && !mqttSettings->mqttBinaryMode)
+		continueDiscovery(callStart);
 
-	if (sendRegular || sendQuick)
+	if (!cycleActive)
 	{
-		bool sendOk = true; //if a mqtt message fails, wait for retransmit at a later time
-		auto inverters = goodweCommunicator->getInvertersInfo();
-		for (char cnt = 0; cnt < inverters.size(); cnt++)
+		bool sendRegular = millis() - lastSentRegularUpdate > mqttSettings->mqttRegularUpdateInterval;
+		bool sendQuick = millis() - lastSentQuickUpdate > mqttSettings->mqttQuickUpdateInterval;
+		if (sendRegular || sendQuick)
 		{
-			auto prependTopic = (String("goodwe/") + String(inverters[cnt].serialNumber));
+			if (sendQuick)
+				lastSentQuickUpdate = millis();
+			if (sendRegular)
+				lastSentRegularUpdate = millis();
+			startCycle(sendQuick, sendRegular);
+		}
+	}
+	if (cycleActive)
+		continueCycle(callStart);
 
-			debugPrint("Publishing prepend topic for this inverter is: ");
-			debugPrintln(prependTopic);
+	//samples kept during an outage
+	drainBacklog(callStart);
+}
 
+//the published values, in publish order. The deadbands are in the units of the value.
+//The home assistant discovery config is made from the component, unit, device class and state class
+const MQTTPublisher::PublishField MQTTPublisher::Fields[] = {
+	{ "online", [](const GoodWeCommunicator::GoodweInverterInformation & inverter) -> double { return inverter.isOnline && inverter.addressConfirmed ? 1.0f : 0.0f; }, 0, 0, PUBLISH_QUICK, "binary_sensor", nullptr, "connectivity", nullptr, false },
+	{ "vpv1", [](const GoodWeCommunicator::GoodweInverterInformation & inverter) -> double { return inverter.vpv1; }, 1, 0.5f, PUBLISH_QUICK, "sensor", "V", "voltage", "measurement", false },
+	{ "vpv2", [](const GoodWeCommunicator::GoodweInverterInformation & inverter) -> double { return inverter.vpv2; }, 1, 0.5f, PUBLISH_QUICK, "sensor", "V", "voltage", "measurement", false },
+	{ "ipv1", [](const GoodWeCommunicator::GoodweInverterInformation & inverter) -> double { return inverter.ipv1; }, 1, 0.1f, PUBLISH_QUICK, "sensor", "A", "current", "measurement", false },
+	{ "ipv2", [](const GoodWeCommunicator::GoodweInverterInformation & inverter) -> double { return inverter.ipv2; }, 1, 0.1f, PUBLISH_QUICK, "sensor", "A", "current", "measurement", false },
+	{ "vac1", [](const GoodWeCommunicator::GoodweInverterInformation & inverter) -> double { return inverter.vac1; }, 1, 0.5f, PUBLISH_QUICK, "sensor", "V", "voltage", "measurement", false },
+	{ "iac1", [](const GoodWeCommunicator::GoodweInverterInformation & inverter) -> double { return inverter.iac1; }, 1, 0.1f, PUBLISH_QUICK, "sensor", "A", "current", "measurement", false },
+	{ "fac1", [](const GoodWeCommunicator::GoodweInverterInformation & inverter) -> double { return inverter.fac1; }, 2, 0.05f, PUBLISH_QUICK, "sensor", "Hz", "frequency", "measurement", false },
+	{ "pac", [](const GoodWeCommunicator::GoodweInverterInformation & inverter) -> double { return (float)inverter.pac; }, 0, 5, PUBLISH_QUICK, "sensor", "W", "power", "measurement", false },
+	{ "temp", [](const GoodWeCommunicator::GoodweInverterInformation & inverter) -> double { return inverter.temp; }, 1, 0.5f, PUBLISH_QUICK, "sensor", "\xC2\xB0""C", "temperature", "measurement", false },
+	{ "vac2", [](const GoodWeCommunicator::GoodweInverterInformation & inverter) -> double { return inverter.vac2; }, 1, 0.5f, PUBLISH_QUICK_DT, "sensor", "V", "voltage", "measurement", false },
+	{ "iac2", [](const GoodWeCommunicator::GoodweInverterInformation & inverter) -> double { return inverter.iac2; }, 1, 0.1f, PUBLISH_QUICK_DT, "sensor", "A", "current", "measurement", false },
+	{ "fac2", [](const GoodWeCommunicator::GoodweInverterInformation & inverter) -> double { return inverter.fac2; }, 2, 0.05f, PUBLISH_QUICK_DT, "sensor", "Hz", "frequency", "measurement", false },
+	{ "vac3", [](const GoodWeCommunicator::GoodweInverterInformation & inverter) -> double { return inverter.vac3; }, 1, 0.5f, PUBLISH_QUICK_DT, "sensor", "V", "voltage", "measurement", false },
+	{ "iac3", [](const GoodWeCommunicator::GoodweInverterInformation & inverter) -> double { return inverter.iac3; }, 1, 0.1f, PUBLISH_QUICK_DT, "sensor", "A", "current", "measurement", false },
+	{ "fac3", [](const GoodWeCommunicator::GoodweInverterInformation & inverter) -> double { return inverter.fac3; }, 2, 0.05f, PUBLISH_QUICK_DT, "sensor", "Hz", "frequency", "measurement", false },
+	{ "workmode", [](const GoodWeCommunicator::GoodweInverterInformation & inverter) -> double { return (float)inverter.workMode; }, 0, 0, PUBLISH_REGULAR, "sensor", nullptr, nullptr, nullptr, false },
+	{ "eday", [](const GoodWeCommunicator::GoodweInverterInformation & inverter) -> double { return inverter.eDay; }, 2, 0, PUBLISH_REGULAR, "sensor", "kWh", "energy", "total_increasing", false },
+	{ "errormessage", [](const GoodWeCommunicator::GoodweInverterInformation & inverter) -> double { return inverter.errorMessage; }, 0, 0, PUBLISH_REGULAR, "sensor", nullptr, nullptr, nullptr, true },
+	{ "etotal", [](const GoodWeCommunicator::GoodweInverterInformation & inverter) -> double { return inverter.eTotal; }, 1, 0, PUBLISH_REGULAR, "sensor", "kWh", "energy", "total_increasing", false },
+	{ "htotal", [](const GoodWeCommunicator::GoodweInverterInformation & inverter) -> double { return inverter.hTotal; }, 0, 0, PUBLISH_REGULAR, "sensor", "h", "duration", "total_increasing", false },
+	{ "tempfault", [](const GoodWeCommunicator::GoodweInverterInformation & inverter) -> double { return inverter.tempFault; }, 1, 0, PUBLISH_REGULAR, "sensor", "\xC2\xB0""C", "temperature", nullptr, false },
+	{ "pv1fault", [](const GoodWeCommunicator::GoodweInverterInformation & inverter) -> double { return inverter.pv1Fault; }, 1, 0, PUBLISH_REGULAR, "sensor", "V", "voltage", nullptr, false },
+	{ "pv2fault", [](const GoodWeCommunicator::GoodweInverterInformation & inverter) -> double { return inverter.pv2Fault; }, 1, 0, PUBLISH_REGULAR, "sensor", "V", "voltage", nullptr, false },
+	{ "line1vfault", [](const GoodWeCommunicator::GoodweInverterInformation & inverter) -> double { return inverter.line1VFault; }, 1, 0, PUBLISH_REGULAR, "sensor", "V", "voltage", nullptr, false },
+	{ "line1ffault", [](const GoodWeCommunicator::GoodweInverterInformation & inverter) -> double { return inverter.line1FFault; }, 2, 0, PUBLISH_REGULAR, "sensor", "Hz", "frequency", nullptr, false },
+	{ "gcfifault", [](const GoodWeCommunicator::GoodweInverterInformation & inverter) -> double { return inverter.gcfiFault; }, 0, 0, PUBLISH_REGULAR, "sensor", "mA", "current", nullptr, false },
+	{ "line2vfault", [](const GoodWeCommunicator::GoodweInverterInformation & inverter) -> double { return inverter.line2VFault; }, 1, 0, PUBLISH_REGULAR_DT, "sensor", "V", "voltage", nullptr, false },
+	{ "line3vfault", [](const GoodWeCommunicator::GoodweInverterInformation & inverter) -> double { return inverter.line3VFault; }, 1, 0, PUBLISH_REGULAR_DT, "sensor", "V", "voltage", nullptr, false },
+	{ "line2ffault", [](const GoodWeCommunicator::GoodweInverterInformation & inverter) -> double { return inverter.line2FFault; }, 2, 0, PUBLISH_REGULAR_DT, "sensor", "Hz", "frequency", nullptr, false },
+	{ "line3ffault", [](const GoodWeCommunicator::GoodweInverterInformation & inverter) -> double { return inverter.line3FFault; }, 2, 0, PUBLISH_REGULAR_DT, "sensor", "Hz", "frequency", nullptr, false },
+};
+const size_t MQTTPublisher::FieldCount = sizeof(MQTTPublisher::Fields) / sizeof(MQTTPublisher::Fields[0]);
+
+//value rounded to a fixed point number with decimals (0-4) decimals. Double, so 32 bit values like the error bits stay exact
+static int32_t toFixed(double value, int decimals)
+{
+	static const int32_t scales[] = { 1, 10, 100, 1000, 10000 };
+	return value * scales[decimals] + (value < 0 ? -0.5 : 0.5);
+}
 
-			//send values when offline or online since the values can be reset when offline
-			if (sendQuick)
+//write a fixed point number with decimals (0-4) decimals as text, integer math only. Returns the text length.
+//isUnsigned: the 32 bits are written as an unsigned number, for bit fields with bit 31 set
+static size_t formatFixed(char * buffer, int32_t fixed, int decimals, bool isUnsigned = false)
+{
+	char * ptr = buffer;
+	bool negative = fixed < 0 && !isUnsigned;
+	if (negative)
+		*ptr++ = '-';
+	uint32_t magnitude = negative ? -(uint32_t)fixed : fixed;
+
+	//digits come out reversed, the decimal point is inserted on the way
+	char digits[16];
+	int digitCount = 0;
+	do
+	{
+		if (digitCount == decimals && decimals)
+			digits[digitCount++] = '.';
+		digits[digitCount++] = '0' + magnitude % 10;
+		magnitude /= 10;
+	} while (magnitude || digitCount <= decimals);
+	while (digitCount)
+		*ptr++ = digits[--digitCount];
+	*ptr = 0;
+	return ptr - buffer;
+}
+
+//write an integer in the smallest MessagePack integer format. Returns the bytes written (max 5)
+static size_t packInt(uint8_t * buffer, int64_t value)
+{
+	if (value >= 0 && value <= 127)
+	{
+		buffer[0] = value; //positive fixint
+		return 1;
+	}
+	if (value < 0 && value >= -32)
+	{
+		buffer[0] = 0xe0 | (value & 0x1f); //negative fixint
+		return 1;
+	}
+	size_t bytes;
+	if (value >= INT8_MIN && value <= INT8_MAX)
+	{
+		buffer[0] = 0xd0;
+		bytes = 1;
+	}
+	else if (value >= INT16_MIN && value <= INT16_MAX)
+	{
+		buffer[0] = 0xd1;
+		bytes = 2;
+	}
+	else if (value >= INT32_MIN && value <= INT32_MAX)
+	{
+		buffer[0] = 0xd2;
+		bytes = 4;
+	}
+	else
+	{
+		buffer[0] = 0xce; //uint32, for unix times after 2038
+		bytes = 4;
+	}
+	//big endian
+	for (size_t cnt = 0; cnt < bytes; cnt++)
+		buffer[bytes - cnt] = (uint8_t)(value >> (cnt * 8));
+	return bytes + 1;
+}
+
+void MQTTPublisher::receiveCommand(const uint8_t * payload, unsigned int length)
+{
+	//called from client.loop(). The payload is in the PubSubClient buffer, which publishing overwrites.
+	//Copy it and execute the command in handle
+	length = min(length, (unsigned int)sizeof(commandBuffer) - 1);
+	memcpy(commandBuffer, payload, length);
+	commandBuffer[length] = 0;
+}
+
+void MQTTPublisher::handleCommand()
+{
+	debugPrint("MQTT command: ");
+	debugPrintln(commandBuffer);
+
+	//<command> [argument]
+	char * argument = strchr(commandBuffer, ' ');
+	if (argument)
+		*argument++ = 0;
+
+	if (strcmp(commandBuffer, "poll") == 0)
+	{
+		//poll <serial> asks one inverter for information right away, poll without a serial all of them
+		if (!goodweCommunicator->pollInverter(argument))
+			debugPrintln("No confirmed inverter to poll.");
+	}
+	else if (strcmp(commandBuffer, "quick") == 0 || strcmp(commandBuffer, "regular") == 0)
+	{
+		//update interval in ms, until the next reboot
+		int interval = argument ? atoi(argument) : 0;
+		if (interval < MQTT_MIN_UPDATE_INTERVAL)
+			debugPrintln("Invalid update interval.");
+		else if (commandBuffer[0] == 'q')
+			mqttSettings->mqttQuickUpdateInterval = interval;
+		else
+			mqttSettings->mqttRegularUpdateInterval = interval;
+	}
+	else if (strcmp(commandBuffer, "discovery") == 0)
+	{
+		//look for new inverters and send the home assistant discovery configs again
+		goodweCommunicator->forceDiscovery();
+		discoveryPublished.assign(discoveryPublished.size(), false);
+		discoveryField = 0;
+	}
+	else if (strcmp(commandBuffer, "stats") == 0)
+		publishStats();
+	else
+		debugPrintln("Unknown MQTT command.");
+
+	commandBuffer[0] = 0;
+}
+
+bool MQTTPublisher::publishStats()
+{
+	//json document on goodwe/<host>/stats. Messages and bytes are of the last (or current) publish cycle
+	setTopicPrefix(mqttSettings->wifiHostname.c_str());
+	int length = snprintf(jsonBuffer, sizeof(jsonBuffer),
+		"{\"uptime\":%lu,\"heap\":%u,\"inverters\":%u,\"quick\":%d,\"regular\":%d,\"messages\":%u,\"bytes\":%lu,\"backlog\":%u,\"dropped\":%u",
+		millis() / 1000, (unsigned int)ESP.getFreeHeap(), (unsigned int)goodweCommunicator->getInvertersInfo().size(),
+		mqttSettings->mqttQuickUpdateInterval, mqttSettings->mqttRegularUpdateInterval, cycleMessages, cycleBytes,
+		(unsigned int)backlog.available(), backlogDropped);
+	return publishJson("stats", length);
+}
+
+void MQTTPublisher::setTopicPrefix(const char * serialNumber)
+{
+	topicPrefixLength = snprintf(topicBuffer, sizeof(topicBuffer), "goodwe/%s", serialNumber);
+}
+
+bool MQTTPublisher::publishOnMQTT(const char * topic, const char * value, bool qos1)
+{
+	//the topic is put after the inverter prefix in place
+	topicBuffer[topicPrefixLength] = '/';
+	strncpy(topicBuffer + topicPrefixLength + 1, topic, sizeof(topicBuffer) - topicPrefixLength - 2);
+	topicBuffer[sizeof(topicBuffer) - 1] = 0;
+	auto retVal = qos1 ? publishQos1(topicBuffer, value) : client.publish(topicBuffer, value);
+	countPublished(strlen(topicBuffer), strlen(value), qos1);
+	yield();
+	return retVal;
+}
+
+bool MQTTPublisher::publishQos1(const char * topic, const char * value)
+{
+	auto message = freeInFlight();
+	if (!message)
+		return false;
+	strncpy(message->topic, topic, sizeof(message->topic) - 1);
+	message->topic[sizeof(message->topic) - 1] = 0;
+	strncpy(message->payload, value, sizeof(message->payload) - 1);
+	message->payload[sizeof(message->payload) - 1] = 0;
+	message->packetId = nextPacketId;
+	message->retransmits = 0;
+	nextPacketId = nextPacketId == 0xffff ? 1 : nextPacketId + 1;
+	if (sendInFlight(*message, false))
+		return true;
+	message->packetId = 0;
+	return false;
+}
+
+bool MQTTPublisher::sendInFlight(InFlightMessage & message, bool duplicate)
+{
+	//PubSubClient only publishes with qos 0. The qos 1 PUBLISH packet is written to the connection directly:
+	//fixed header, remaining length, topic length, topic, packet id and payload
+	size_t topicLength = strlen(message.topic);
+	size_t payloadLength = strlen(message.payload);
+	size_t remaining = 2 + topicLength + 2 + payloadLength;
+	uint8_t packet[5 + 2 + MQTT_TOPIC_BUFFER_SIZE + 2 + sizeof(message.payload)];
+	size_t length = 0;
+	packet[length++] = 0x32 | (duplicate ? 0x08 : 0);
+	do
+	{
+		packet[length++] = (remaining & 0x7f) | (remaining > 0x7f ? 0x80 : 0);
+		remaining >>= 7;
+	} while (remaining);
+	packet[length++] = topicLength >> 8;
+	packet[length++] = topicLength & 0xff;
+	memcpy(packet + length, message.topic, topicLength);
+	length += topicLength;
+	packet[length++] = message.packetId >> 8;
+	packet[length++] = message.packetId & 0xff;
+	memcpy(packet + length, message.payload, payloadLength);
+	length += payloadLength;
+
+	message.sentAt = millis();
+	return client.connected() && espClient.write(packet, length) == length;
+}
+
+MQTTPublisher::InFlightMessage * MQTTPublisher::freeInFlight()
+{
+	for (auto & message : inFlight)
+	{
+		if (!message.packetId)
+			return &message;
+	}
+	return nullptr;
+}
+
+void MQTTPublisher::receivePackets()
+{
+	//PubSubClient reads one packet per loop and waits for the rest of a packet it started to read. It is only
+	//left complete packets, a packet that did not fully arrive is read in a later call
+	for (int packets = 0; packets < MQTT_RECEIVE_PACKETS; packets++)
+	{
+		if (espClient.available() && !espClient.packetAvailable())
+			return;
+		client.loop();
+		if (auto packetId = espClient.takeAck())
+		{
+			for (auto & message : inFlight)
 			{
-				//send out fast changing values
-				if (sendOk) sendOk = publishOnMQTT(prependTopic, "/online", inverters[cnt].isOnline && inverters[cnt].addressConfirmed ? "1" : "0");
-				if (sendOk) sendOk = publishOnMQTT(prependTopic, "/vpv1", String(inverters[cnt].vpv1, 1));
-				if (sendOk) sendOk = publishOnMQTT(prependTopic, "/vpv2", String(inverters[cnt].vpv2, 1));
-				if (sendOk) sendOk = publishOnMQTT(prependTopic, "/ipv1", String(inverters[cnt].ipv1, 1));
-				if (sendOk) sendOk = publishOnMQTT(prependTopic, "/ipv2", String(inverters[cnt].ipv2, 1));
-				//publishing sometimes cuases the wdt to reset the ESP. 
-				//On the github page of the pubsubclient it was suggested to add extra client.loop().
-				client.loop();
-				if (sendOk) sendOk = publishOnMQTT(prependTopic, "/vac1", String(inverters[cnt].vac1, 1));
-				if (sendOk) sendOk = publishOnMQTT(prependTopic, "/iac1", String(inverters[cnt].iac1, 1));
-				if (sendOk) sendOk = publishOnMQTT(prependTopic, "/fac1", String(inverters[cnt].fac1, 2));
-				if (sendOk) sendOk = publishOnMQTT(prependTopic, "/pac", String(inverters[cnt].pac));
-				if (sendOk) sendOk = publishOnMQTT(prependTopic, "/temp", String(inverters[cnt].temp, 1));
-
-				if (inverters[cnt].isDTSeries)
-				{
-					//On the github page of the pubsubclient it was suggested to add extra client.loop().
-					client.loop();
-					//also send tri fase info
-					if (sendOk) sendOk = publishOnMQTT(prependTopic, "/vac2", String(inverters[cnt].vac2, 1));
-					if (sendOk) sendOk = publishOnMQTT(prependTopic, "/iac2", String(inverters[cnt].iac2, 1));
-					if (sendOk) sendOk = publishOnMQTT(prependTopic, "/fac2", String(inverters[cnt].fac2, 2));
-					if (sendOk) sendOk = publishOnMQTT(prependTopic, "/vac3", String(inverters[cnt].vac3, 1));
-					if (sendOk) sendOk = publishOnMQTT(prependTopic, "/iac3", String(inverters[cnt].iac3, 1));
-					if (sendOk) sendOk = publishOnMQTT(prependTopic, "/fac3", String(inverters[cnt].fac3, 2));
-				}
+				if (message.packetId == packetId)
+					message.packetId = 0;
 			}
-			else
+		}
+		if (commandBuffer[0])
+			handleCommand();
+		if (!espClient.available())
+			return;
+	}
+}
+
+void MQTTPublisher::retransmitInFlight(unsigned long callStart)
+{
+	for (auto & message : inFlight)
+	{
+		if (!message.packetId || millis() - message.sentAt < MQTT_RETRANSMIT_INTERVAL)
+			continue;
+		if (message.retransmits == MQTT_MAX_RETRANSMITS)
+		{
+			debugPrint("MQTT qos 1 message not acknowledged, dropped: ");
+			debugPrintln(message.topic);
+			message.packetId = 0;
+			continue;
+		}
+		if (!canPublish(callStart))
+			return;
+		message.retransmits++;
+		if (sendInFlight(message, true))
+			countPublished(strlen(message.topic), strlen(message.payload), true);
+	}
+}
+
+bool MQTTPublisher::needsPublish(const PublishField & field, const PublishedValue & published, int32_t value)
+{
+	//without a max age every value is published every interval
+	if (!mqttSettings->mqttMaxAge || !published.published)
+		return true;
+	//the age is taken in 16 bits, a longer max age would never be reached before the wrap
+	uint16_t maxAge = min(mqttSettings->mqttMaxAge / 1000, MQTT_MAX_AGE_LIMIT);
+	if ((uint16_t)(millis() / 1000 - published.publishedAt) >= maxAge)
+		return true;
+	//64 bit, the difference of two 32 bit values (error bits) does not fit 32 bits
+	int64_t change = (int64_t)value - published.value;
+	return (change < 0 ? -change : change) > toFixed(field.deadband, field.decimals);
+}
+
+bool MQTTPublisher::isRegular(const PublishField & field)
+{
+	return field.group == PUBLISH_REGULAR || field.group == PUBLISH_REGULAR_DT;
+}
+
+bool MQTTPublisher::hasField(const PublishField & field, bool isDTSeries)
+{
+	//phase 2 and 3 values only for tri phase inverters
+	return isDTSeries || (field.group != PUBLISH_QUICK_DT && field.group != PUBLISH_REGULAR_DT);
+}
+
+bool MQTTPublisher::canPublish(unsigned long callStart)
+{
+	//refill the token bucket: MQTT_PUBLISH_RATE messages per second, at most MQTT_PUBLISH_BURST saved up
+	auto elapsed = min(millis() - lastTokenRefill, (unsigned long)MQTT_PUBLISH_BURST * 1000);
+	lastTokenRefill = millis();
+	publishTokens = min(publishTokens + elapsed * MQTT_PUBLISH_RATE, (unsigned long)MQTT_PUBLISH_BURST * 1000);
+	return publishTokens >= 1000 && micros() - callStart < MQTT_PUBLISH_BUDGET;
+}
+
+void MQTTPublisher::startCycle(bool sendQuick, bool sendRegular)
+{
+	cycleActive = true;
+	cycleQuick = sendQuick;
+	cycleRegular = sendRegular;
+	cycleInverter = 0;
+	cycleField = 0;
+	cycleMessages = 0;
+	cycleBytes = 0;
+	cycleBusy = 0;
+	cycleStart = millis();
+}
+
+void MQTTPublisher::continueCycle(unsigned long callStart)
+{
+	auto stepsStart = micros();
+	//reference to the inverter list, the publish cycle does not allocate
+	auto& inverters = goodweCommunicator->getInvertersInfo();
+	//inverters are only added, the published values of the existing ones stay in place
+	if (publishedValues.size() < inverters.size() * FieldCount)
+		publishedValues.resize(inverters.size() * FieldCount);
+
+	bool sendOk = true; //if a mqtt message fails, wait for retransmit at a later time
+	while (cycleInverter < inverters.size() && canPublish(callStart))
+	{
+		auto & inverter = inverters[cycleInverter];
+		auto published = &publishedValues[cycleInverter * FieldCount];
+		setTopicPrefix(inverter.serialNumber);
+		if (mqttSettings->mqttJsonMode || mqttSettings->mqttBinaryMode)
+		{
+			//the whole sample in one document, quick and regular values alike
+			sendOk = publishState(inverter, published);
+			cycleInverter++;
+		}
+		else
+		{
+			//a regular value waits for a free slot in the qos 1 window, without failing the cycle
+			if (isRegular(Fields[cycleField]) && cycleRegular && !freeInFlight())
+				break;
+			//send values when offline or online since the values can be reset when offline
+			sendOk = publishField(inverter, published, cycleField);
+			if (++cycleField == FieldCount)
 			{
-				//regular
-				if (sendOk) sendOk = publishOnMQTT(prependTopic, "/workmode", String(inverters[cnt].workMode));
-				if (sendOk) sendOk = publishOnMQTT(prependTopic, "/eday", String(inverters[cnt].eDay));
-				//TODO: Rest of data 
+				cycleField = 0;
+				cycleInverter++;
 			}
+		}
+		if (!sendOk)
+			break;
+	}
+	cycleBusy += micros() - stepsStart;
+	if (sendOk && cycleInverter < inverters.size())
+		return; //continue in the next call
+
+	cycleActive = false;
+	debugPrint("MQTT send status: ");
+	debugPrintln(sendOk);
+	debugPrint("MQTT cycle: ");
+	debugPrint(cycleMessages);
+	debugPrint(" messages, ");
+	debugPrint(cycleBytes);
+	debugPrint(" bytes, ");
+	debugPrint(millis() - cycleStart);
+	debugPrint(" ms, ");
+	debugPrint(cycleBusy);
+	debugPrint(" us publishing, free heap: ");
+	debugPrintln(ESP.getFreeHeap());
+}
 
+bool MQTTPublisher::publishField(const GoodWeCommunicator::GoodweInverterInformation & inverter, PublishedValue * published, size_t index)
+{
+	auto & field = Fields[index];
+	if (!hasField(field, inverter.isDTSeries))
+		return true;
+	if (isRegular(field) ? !cycleRegular : !cycleQuick)
+		return true;
 
+	auto value = toFixed(field.value(inverter), field.decimals);
+	if (!needsPublish(field, published[index], value))
+		return true;
 
-			//On the github page of the pubsubclient it was suggested to add extra client.loop().
-			client.loop();
-		}
+	formatFixed(valueBuffer, value, field.decimals, field.isUnsigned);
+	if (!publishOnMQTT(field.name, valueBuffer, isRegular(field)))
+		return false;
+	published[index].value = value;
+	published[index].publishedAt = millis() / 1000;
+	published[index].published = true;
+	return true;
+}
 
-		if (sendQuick)
-			lastSentQuickUpdate = millis();
-		if (sendRegular)
-			lastSentRegularUpdate = millis();
+size_t MQTTPublisher::encodeBinary(int64_t time, const int32_t * values, bool isDTSeries)
+{
+	//MessagePack array [schema version, time, values...]. The values are the fixed point numbers in the order
+	//of the field table, nil for the fields the inverter does not have. Decoded by tools/goodwe_decode.py
+	static_assert(3 + 5 * (2 + MQTT_FIELD_COUNT) <= MQTT_JSON_BUFFER_SIZE, "binary sample does not fit the json buffer");
+	auto buffer = reinterpret_cast<uint8_t*>(jsonBuffer);
+	size_t length = 0;
+	buffer[length++] = 0xdc; //array 16
+	buffer[length++] = (2 + FieldCount) >> 8;
+	buffer[length++] = (2 + FieldCount) & 0xff;
+	length += packInt(buffer + length, MQTT_BINARY_SCHEMA_VERSION);
+	length += packInt(buffer + length, time);
+	for (size_t cnt = 0; cnt < FieldCount; cnt++)
+	{
+		if (!hasField(Fields[cnt], isDTSeries))
+			buffer[length++] = 0xc0; //nil
+		else
+			length += packInt(buffer + length, Fields[cnt].isUnsigned ? (int64_t)(uint32_t)values[cnt] : values[cnt]);
+	}
+	return length;
+}
 
+void MQTTPublisher::getFixedValues(const GoodWeCommunicator::GoodweInverterInformation & inverter, int32_t * values)
+{
+	static_assert(sizeof(Fields) / sizeof(Fields[0]) == MQTT_FIELD_COUNT, "MQTT_FIELD_COUNT must match the field table");
+	for (size_t cnt = 0; cnt < FieldCount; cnt++)
+		values[cnt] = toFixed(Fields[cnt].value(inverter), Fields[cnt].decimals);
+}
 
-		debugPrint("MQTT send status: ");
-		debugPrintln(sendOk);
+bool MQTTPublisher::publishState(const GoodWeCommunicator::GoodweInverterInformation & inverter, PublishedValue * published)
+{
+	int32_t values[MQTT_FIELD_COUNT];
+	getFixedValues(inverter, values);
 
+	//the document is sent when any of its values needs publishing
+	bool needed = false;
+	for (size_t cnt = 0; cnt < FieldCount && !needed; cnt++)
+	{
+		if (hasField(Fields[cnt], inverter.isDTSeries))
+			needed = needsPublish(Fields[cnt], published[cnt], values[cnt]);
+	}
+	if (!needed)
+		return true;
+
+	//encoded once, the other brokers send the same bytes while the sample does not change
+	bool binary = mqttSettings->mqttBinaryMode;
+	int64_t time = binary ? sampleTimestamp(inverter.sampleTime) : 0;
+	if (!encodedState.valid || encodedState.binary != binary || encodedState.isDTSeries != inverter.isDTSeries ||
+		encodedState.time != time || memcmp(encodedState.values, values, sizeof(values)) != 0)
+	{
+		//the encoding overwrites jsonBuffer, the other brokers must not send it when it fails half way
+		encodedState.valid = false;
+		int length = binary ? (int)encodeBinary(time, values, inverter.isDTSeries) : closeJson(appendJsonValues(0, values, inverter.isDTSeries));
+		if (length < 0)
+			return false;
+		encodedState.valid = true;
+		encodedState.binary = binary;
+		encodedState.isDTSeries = inverter.isDTSeries;
+		encodedState.time = time;
+		memcpy(encodedState.values, values, sizeof(values));
+		encodedState.length = length;
+	}
+	if (!publishPayload(binary ? "bin" : "state", reinterpret_cast<const uint8_t*>(jsonBuffer), encodedState.length))
+		return false;
+	for (size_t cnt = 0; cnt < FieldCount; cnt++)
+	{
+		published[cnt].value = values[cnt];
+		published[cnt].publishedAt = millis() / 1000;
+		published[cnt].published = true;
+	}
+	return true;
+}
+
+bool MQTTPublisher::publishJson(const char * topic, int length)
+{
+	//a document other than the state, the shared buffer no longer holds the state
+	encodedState.valid = false;
+	length = closeJson(length);
+	if (length < 0)
+		return false;
+	return publishPayload(topic, reinterpret_cast<const uint8_t*>(jsonBuffer), length);
+}
+
+int MQTTPublisher::closeJson(int length)
+{
+	if (length <= 0 || length + 1 >= (int)sizeof(jsonBuffer))
+	{
+		debugPrintln("MQTT json document too large for the buffer.");
+		return -1;
 	}
+	jsonBuffer[length++] = '}';
+	jsonBuffer[length] = 0;
+	return length;
 }
 
-bool MQTTPublisher::publishOnMQTT(String prepend, String topic, String value)
+bool MQTTPublisher::publishPayload(const char * topic, const uint8_t * payload, size_t length)
 {
-	auto retVal = client.publish((prepend.c_str() + topic).c_str(), value.c_str());
+	topicBuffer[topicPrefixLength] = '/';
+	strncpy(topicBuffer + topicPrefixLength + 1, topic, sizeof(topicBuffer) - topicPrefixLength - 2);
+	topicBuffer[sizeof(topicBuffer) - 1] = 0;
+
+	//stream the payload, a json document does not fit the PubSubClient packet buffer
+	if (!client.beginPublish(topicBuffer, length, false))
+		return false;
+	client.write(payload, length);
+	auto retVal = client.endPublish() == 1;
+	countPublished(strlen(topicBuffer), length);
 	yield();
 	return retVal;
 }
 
+int MQTTPublisher::appendJsonValues(int length, const int32_t * values, bool isDTSeries)
+{
+	//built in the preallocated buffer after length bytes already there. snprintf returns the length
+	//it needed, so an overflow carries through to the end
+	for (size_t cnt = 0; cnt < FieldCount; cnt++)
+	{
+		auto & field = Fields[cnt];
+		if (!hasField(field, isDTSeries))
+			continue;
+		if (length < 0 || length >= (int)sizeof(jsonBuffer))
+			return -1;
+		formatFixed(valueBuffer, values[cnt], field.decimals, field.isUnsigned);
+		length += snprintf(jsonBuffer + length, sizeof(jsonBuffer) - length, "%c\"%s\":%s", length ? ',' : '{', field.name, valueBuffer);
+	}
+	return length;
+}
+
+int64_t MQTTPublisher::sampleTimestamp(unsigned long sampleTime)
+{
+	//time of the binary samples: unix time of the sample if the clock is set, else the negative age in seconds
+	auto age = (millis() - sampleTime) / 1000;
+	return timeStatus() != timeNotSet ? (int64_t)(now() - age) : -(int64_t)age;
+}
+
+void MQTTPublisher::storeBacklog()
+{
+	auto& inverters = goodweCommunicator->getInvertersInfo();
+	if (lastBacklogSampleTime.size() < inverters.size())
+		lastBacklogSampleTime.resize(inverters.size(), 0);
+	for (char cnt = 0; cnt < inverters.size(); cnt++)
+	{
+		//only new samples of online inverters
+		if (!inverters[cnt].isOnline || inverters[cnt].sampleTime == lastBacklogSampleTime[cnt])
+			continue;
+		lastBacklogSampleTime[cnt] = inverters[cnt].sampleTime;
+
+		//full: drop the oldest sample, the recent ones are worth more
+		if (!backlog.available_for_push())
+		{
+			backlog.commit_read(1);
+			backlogDropped++;
+		}
+		auto & sample = backlog.pushpeek();
+		sample.sampleTime = inverters[cnt].sampleTime;
+		sample.inverterIndex = cnt;
+		sample.isDTSeries = inverters[cnt].isDTSeries;
+		getFixedValues(inverters[cnt], sample.values);
+		backlog.push();
+	}
+}
+
+void MQTTPublisher::drainBacklog(unsigned long callStart)
+{
+	//one sample per interval, so the replay does not hold up the inverter communication
+	if (!backlog.available() || millis() - lastBacklogSent < MQTT_BACKLOG_DRAIN_INTERVAL || !canPublish(callStart))
+		return;
+	lastBacklogSent = millis();
+
+	const BacklogSample * sample;
+	backlog.peek_contiguous(sample);
+	setTopicPrefix(goodweCommunicator->getInvertersInfo()[sample->inverterIndex].serialNumber);
+
+	//the original sample time. As unix time if the clock is set, else as the age in seconds
+	auto age = (millis() - sample->sampleTime) / 1000;
+	if (mqttSettings->mqttBinaryMode)
+	{
+		//same topic as the live samples, the time tells them apart
+		encodedState.valid = false;
+		if (publishPayload("bin", reinterpret_cast<const uint8_t*>(jsonBuffer), encodeBinary(sampleTimestamp(sample->sampleTime), sample->values, sample->isDTSeries)))
+			backlogSent();
+		return;
+	}
+
+	int length;
+	if (timeStatus() != timeNotSet)
+		length = snprintf(jsonBuffer, sizeof(jsonBuffer), "{\"ts\":%lu", (unsigned long)(now() - age));
+	else
+		length = snprintf(jsonBuffer, sizeof(jsonBuffer), "{\"age\":%lu", (unsigned long)age);
+	if (publishJson("history", appendJsonValues(length, sample->values, sample->isDTSeries)))
+		backlogSent();
+}
+
+void MQTTPublisher::backlogSent()
+{
+	backlog.commit_read(1);
+	if (!backlog.available())
+	{
+		debugPrint("MQTT backlog sent. Samples dropped during the outage: ");
+		debugPrintln(backlogDropped);
+		backlogDropped = 0;
+	}
+}
+
+void MQTTPublisher::continueDiscovery(unsigned long callStart)
+{
+	auto& inverters = goodweCommunicator->getInvertersInfo();
+	if (discoveryPublished.size() < inverters.size())
+		discoveryPublished.resize(inverters.size(), false);
+
+	//one inverter at a time, discoveryField is the next config to send
+	for (char cnt = 0; cnt < inverters.size(); cnt++)
+	{
+		if (!inverters[cnt].addressConfirmed || discoveryPublished[cnt])
+			continue;
+		if (discoveryField == 0)
+		{
+			debugPrint("Publishing home assistant discovery for inverter: ");
+			debugPrintln(inverters[cnt].serialNumber);
+		}
+		while (discoveryField < FieldCount && canPublish(callStart))
+		{
+			if (!publishDiscovery(inverters[cnt], Fields[discoveryField]))
+				return; //try again in the next call
+			discoveryField++;
+		}
+		if (discoveryField == FieldCount)
+		{
+			discoveryPublished[cnt] = true;
+			discoveryField = 0;
+		}
+		return;
+	}
+}
+
+bool MQTTPublisher::publishDiscovery(const GoodWeCommunicator::GoodweInverterInformation & inverter, const PublishField & field)
+{
+	if (!hasField(field, inverter.isDTSeries))
+		return true;
+
+	char discoveryTopic[MQTT_DISCOVERY_TOPIC_BUFFER_SIZE];
+	snprintf(discoveryTopic, sizeof(discoveryTopic), "homeassistant/%s/goodwe_%s_%s/config", field.component, inverter.serialNumber, field.name);
+
+	//the config is larger than the PubSubClient packet buffer. The parts are formatted twice, once for the length and once to send
+	size_t length = 0;
+	for (int part = 0; part < MQTT_DISCOVERY_PARTS; part++)
+	{
+		int partLength = formatDiscoveryPart(part, field, inverter.serialNumber);
+		//a config that does not fit is skipped, it would not fit the next time either
+		if (partLength < 0)
+			return true;
+		length += partLength;
+	}
+	if (!client.beginPublish(discoveryTopic, length, true))
+		return false;
+	for (int part = 0; part < MQTT_DISCOVERY_PARTS; part++)
+	{
+		auto partLength = formatDiscoveryPart(part, field, inverter.serialNumber);
+		client.write(reinterpret_cast<const uint8_t*>(discoveryBuffer), partLength);
+	}
+	if (client.endPublish() != 1)
+		return false;
+	countPublished(strlen(discoveryTopic), length);
+	yield();
+	return true;
+}
+
+int MQTTPublisher::formatDiscoveryPart(int part, const PublishField & field, const char * serialNumber)
+{
+	int length = 0;
+	switch (part)
+	{
+	case 0:
+		length = snprintf(discoveryBuffer, sizeof(discoveryBuffer), "{\"name\":\"GoodWe %s %s\",\"unique_id\":\"goodwe_%s_%s\"",
+			serialNumber, field.name, serialNumber, field.name);
+		break;
+	case 1:
+		//in json mode all values are in the state document
+		if (mqttSettings->mqttJsonMode)
+			length = snprintf(discoveryBuffer, sizeof(discoveryBuffer), ",\"state_topic\":\"goodwe/%s/state\",\"value_template\":\"{{ value_json.%s }}\"",
+				serialNumber, field.name);
+		else
+			length = snprintf(discoveryBuffer, sizeof(discoveryBuffer), ",\"state_topic\":\"goodwe/%s/%s\"", serialNumber, field.name);
+		break;
+	case 2:
+		if (strcmp(field.component, "binary_sensor") == 0)
+			length = snprintf(discoveryBuffer, sizeof(discoveryBuffer), ",\"payload_on\":\"1\",\"payload_off\":\"0\"");
+		//snprintf returns the length it needed, stop before the next one is given a size past the buffer
+		if (field.unit && length < (int)sizeof(discoveryBuffer))
+			length += snprintf(discoveryBuffer + length, sizeof(discoveryBuffer) - length, ",\"unit_of_measurement\":\"%s\"", field.unit);
+		if (field.deviceClass && length < (int)sizeof(discoveryBuffer))
+			length += snprintf(discoveryBuffer + length, sizeof(discoveryBuffer) - length, ",\"device_class\":\"%s\"", field.deviceClass);
+		if (field.stateClass && length < (int)sizeof(discoveryBuffer))
+			length += snprintf(discoveryBuffer + length, sizeof(discoveryBuffer) - length, ",\"state_class\":\"%s\"", field.stateClass);
+		break;
+	case 3:
+		length = snprintf(discoveryBuffer, sizeof(discoveryBuffer), ",\"device\":{\"identifiers\":[\"goodwe_%s\"],\"name\":\"GoodWe %s\",\"manufacturer\":\"GoodWe\"}}",
+			serialNumber, serialNumber);
+		break;
+	}
+	if (length < 0 || length >= (int)sizeof(discoveryBuffer))
+	{
+		debugPrintln("MQTT discovery config too large for the buffer.");
+		return -1;
+	}
+	return length;
+}
+
+void MQTTPublisher::countPublished(size_t topicLength, size_t payloadLength, bool qos1)
+{
+	//mqtt publish packet: fixed header byte, remaining length, topic length, topic, packet id (qos 1) and payload
+	size_t remaining = 2 + topicLength + (qos1 ? 2 : 0) + payloadLength;
+	//every message takes a token of the rate limiter
+	publishTokens = publishTokens >= 1000 ? publishTokens - 1000 : 0;
+	cycleMessages++;
+	cycleBytes += 1 + (remaining < 128 ? 1 : remaining < 16384 ? 2 : 3) + remaining;
+}
+
@@ -1,4 +1,3 @@
-#define MQTT_SOCKET_TIMEOUT 5
 #pragma once
 #include <Arduino.h>
 #include <ESP8266WiFi.h>
@@ -8,26 +7,222 @@
 #include "PubSubClient.h"
 #include "WiFiClient.h"
 #include "Debug.h"
+#include "circular_queue/circular_queue.h"
 
 #define RECONNECT_TIMEOUT 15000
+#define MQTT_DNS_TIMEOUT 250				//ms, the connect steps are made in separate handle calls
+#define MQTT_TCP_CONNECT_TIMEOUT 250		//ms
+#define MQTT_SESSION_TIMEOUT 2000			//ms to wait for the CONNACK, polled in the handle calls
+#define MQTT_READ_TIMEOUT 1					//seconds PubSubClient waits for the rest of a packet it started to read
+#define MQTT_JSON_BUFFER_SIZE 640		//largest state document (tri phase inverter) is about 480 bytes
+#define MQTT_BINARY_SCHEMA_VERSION 2	//first element of the binary samples. Increase when the field table changes
+#define MQTT_TOPIC_BUFFER_SIZE 48
+#define MQTT_DISCOVERY_TOPIC_BUFFER_SIZE 96
+#define MQTT_DISCOVERY_BUFFER_SIZE 128		//a part of a discovery config, the config is streamed in parts
+#define MQTT_DISCOVERY_PARTS 4
+#define MQTT_FIELD_COUNT 31					//number of entries in the field table
+#define MQTT_BACKLOG_CAPACITY 32			//samples kept while the broker is unreachable (power of two), about 130 bytes each
+#define MQTT_BACKLOG_DRAIN_INTERVAL 250		//ms between the samples sent when the broker is back
+#define MQTT_PUBLISH_BUDGET 20000			//us per handle call to spend on publishing, the rest is sent in the next calls
+#define MQTT_PUBLISH_RATE 20				//messages per second
+#define MQTT_PUBLISH_BURST 10				//messages that can be sent at once after a quiet period
+#define MQTT_INFLIGHT_WINDOW 4				//qos 1 messages waiting for their PUBACK
+#define MQTT_RETRANSMIT_INTERVAL 5000		//ms without PUBACK before a qos 1 message is sent again
+#define MQTT_MAX_RETRANSMITS 3				//qos 1 message dropped after this many retransmits
+#define MQTT_COMMAND_BUFFER_SIZE 48			//longest command on goodwe/<host>/cmd
+#define MQTT_RECEIVE_PACKETS 8				//packets read per handle call, the PUBACKs of the window and a command
+#define MQTT_MIN_UPDATE_INTERVAL 1000		//ms, lowest update interval that can be set with a command
+#define MQTT_MAX_AGE_LIMIT 60000			//seconds, highest max age. The 16 bit publish times wrap after 65536 seconds
 
 
 class MQTTPublisher
 {
 private:
+	enum PublishGroup : uint8_t
+	{
+		PUBLISH_QUICK,			//fast changing values, sent with the quick update
+		PUBLISH_QUICK_DT,		//fast changing values of phase 2 and 3, only for tri phase inverters
+		PUBLISH_REGULAR,		//slow changing values, sent with the regular update
+		PUBLISH_REGULAR_DT		//slow changing values of phase 2 and 3
+	};
+
+	//a published inverter value
+	struct PublishField
+	{
+		const char * name;		//topic below goodwe/<serial> and json key
+		double(*value)(const GoodWeCommunicator::GoodweInverterInformation & inverter);
+		uint8_t decimals;
+		float deadband;			//with publish on change: publish when the value moved more than this
+		PublishGroup group;
+		const char * component;		//home assistant discovery: sensor or binary_sensor
+		const char * unit;			//home assistant discovery, nullptr if not applicable
+		const char * deviceClass;
+		const char * stateClass;
+		bool isUnsigned;		//32 bit value published as unsigned (error bits), kept as int32_t like the others
+	};
+	static const PublishField Fields[];
+	static const size_t FieldCount;
+	static bool isRegular(const PublishField & field);
+	static bool hasField(const PublishField & field, bool isDTSeries);
+
+	//last published value (fixed point at the field decimals) and time of a field
+	struct PublishedValue
+	{
+		int32_t value = 0;
+		uint16_t publishedAt = 0;	//seconds, wraps after 18 hours
+		bool published = false;
+	};
+	std::vector<PublishedValue> publishedValues;	//FieldCount values per inverter, in the order of the inverters
+	std::vector<bool> discoveryPublished;			//home assistant discovery sent since the (re)connect, per inverter
+
+	//qos 1 message sent, waiting for its PUBACK. The regular values (energy counters) are sent with qos 1
+	struct InFlightMessage
+	{
+		uint16_t packetId = 0;		//0: free slot
+		uint8_t retransmits = 0;
+		unsigned long sentAt = 0;
+		char topic[MQTT_TOPIC_BUFFER_SIZE];
+		char payload[16];
+	};
+	InFlightMessage inFlight[MQTT_INFLIGHT_WINDOW];
+	uint16_t nextPacketId = 1;
+
+	//an inverter sample kept while the broker is unreachable
+	struct BacklogSample
+	{
+		unsigned long sampleTime;		//millis() of the sample
+		char inverterIndex;
+		bool isDTSeries;
+		int32_t values[MQTT_FIELD_COUNT];	//fixed point at the field decimals
+	};
+	circular_queue<BacklogSample, MQTT_BACKLOG_CAPACITY> backlog;
+	std::vector<unsigned long> lastBacklogSampleTime;	//sample time of the last sample stored, per inverter
+	unsigned long lastBacklogSent = 0;
+	unsigned int backlogDropped = 0;				//oldest samples dropped because the backlog was full
+
 	SettingsManager::Settings * mqttSettings;
 	SettingsManager * mqttSettingsManager;
 	GoodWeCommunicator * goodweCommunicator;
-	bool isStarted;
+	bool isStarted = false;
+
+	//connection to the broker. PubSubClient::connect waits for the CONNACK, it is given a CONNACK to return
+	//right away and the one of the broker is read in the next handle calls. PubSubClient drops the PUBACKs,
+	//the connection follows the packets PubSubClient reads and keeps the packet id of a PUBACK
+	class BrokerConnection : public WiFiClient
+	{
+	public:
+		void presentConnack();
+		bool packetAvailable();
+		uint16_t takeAck();
+		int available() override { return connackLeft ? connackLeft : WiFiClient::available(); }
+		int read() override;
+		using WiFiClient::read;
+	private:
+		static const uint8_t Connack[4];	//CONNACK, connection accepted
+		uint8_t connackLeft = 0;
+		//packet being read: fixed header, remaining length (lengthShift 0xff when read) and the bytes left
+		uint8_t packetType = 0;
+		uint8_t lengthShift = 0;
+		uint32_t remaining = 0;
+		uint16_t ackId = 0;					//packet id of the PUBACK being read
+		uint16_t lastAck = 0;				//packet id of the last complete PUBACK, 0: none
+	};
+
+	//the broker of this publisher. Every broker has its own publisher with its own connection, backlog and rate limit
+	int brokerIndex;
+	SettingsManager::MqttBroker * broker;
+	BrokerConnection espClient;
+	PubSubClient client;
+
+	//state document last encoded in jsonBuffer. The publishers of the other brokers send it again as long as the sample is the same
+	struct EncodedState
+	{
+		bool valid = false;
+		bool binary;
+		bool isDTSeries;
+		int64_t time;
+		int32_t values[MQTT_FIELD_COUNT];
+		size_t length;
+	};
+	static EncodedState encodedState;
+
+	enum ConnectState : uint8_t
+	{
+		CONNECT_IDLE,			//waiting for the next connection attempt
+		CONNECT_RESOLVE,		//look up the server address
+		CONNECT_TCP,			//open the tcp connection and send the mqtt CONNECT
+		CONNECT_SESSION,		//waiting for the CONNACK
+		CONNECT_DONE
+	};
+	ConnectState connectState = CONNECT_IDLE;
+	IPAddress brokerAddress;
+	unsigned long sessionStart = 0;					//CONNECT sent
 
 	unsigned long lastConnectionAttempt = 0;		//last reconnect
 	unsigned long lastSentQuickUpdate = 0;			//last update of the fast changing info
 	unsigned long lastSentRegularUpdate = 0;		//last update of the regular update info
 
-	bool publishOnMQTT(String prepend, String topic, String value);
-	bool reconnect();
+	//preallocated buffers, publishing does not allocate
+	static char jsonBuffer[MQTT_JSON_BUFFER_SIZE];	//shared by the publishers of all brokers
+	char topicBuffer[MQTT_TOPIC_BUFFER_SIZE];		//goodwe/<serial> prefix of the current inverter, the topic is appended in place
+	size_t topicPrefixLength = 0;
+	char valueBuffer[16];
+	char discoveryBuffer[MQTT_DISCOVERY_BUFFER_SIZE];
+	char commandBuffer[MQTT_COMMAND_BUFFER_SIZE] = { 0 };	//command received on goodwe/<host>/cmd, executed in handle
+
+	//the publish cycle in progress. It is sent over several handle calls, the cursor is the next inverter and field
+	bool cycleActive = false;
+	bool cycleQuick = false;
+	bool cycleRegular = false;
+	size_t cycleInverter = 0;
+	size_t cycleField = 0;
+	size_t discoveryField = 0;				//next home assistant discovery config of the inverter being announced
+
+	//token bucket limiting the message rate, in thousandths of a message
+	unsigned long publishTokens = MQTT_PUBLISH_BURST * 1000;
+	unsigned long lastTokenRefill = 0;
+
+	//statistics of the current publish cycle
+	unsigned int cycleMessages = 0;
+	unsigned long cycleBytes = 0;
+	unsigned long cycleStart = 0;			//millis
+	unsigned long cycleBusy = 0;			//us spent publishing
+
+	void setTopicPrefix(const char * serialNumber);
+	void receiveCommand(const uint8_t * payload, unsigned int length);
+	void handleCommand();
+	bool publishStats();
+	bool publishOnMQTT(const char * topic, const char * value, bool qos1 = false);
+	bool publishQos1(const char * topic, const char * value);
+	bool sendInFlight(InFlightMessage & message, bool duplicate);
+	InFlightMessage * freeInFlight();
+	void receivePackets();
+	void retransmitInFlight(unsigned long callStart);
+	bool canPublish(unsigned long callStart);
+	void startCycle(bool sendQuick, bool sendRegular);
+	void continueCycle(unsigned long callStart);
+	bool publishField(const GoodWeCommunicator::GoodweInverterInformation & inverter, PublishedValue * published, size_t index);
+	void getFixedValues(const GoodWeCommunicator::GoodweInverterInformation & inverter, int32_t * values);
+	bool publishState(const GoodWeCommunicator::GoodweInverterInformation & inverter, PublishedValue * published);
+	bool publishJson(const char * topic, int length);
+	int closeJson(int length);
+	bool publishPayload(const char * topic, const uint8_t * payload, size_t length);
+	size_t encodeBinary(int64_t time, const int32_t * values, bool isDTSeries);
+	int64_t sampleTimestamp(unsigned long sampleTime);
+	int appendJsonValues(int length, const int32_t * values, bool isDTSeries);
+	void storeBacklog();
+	void drainBacklog(unsigned long callStart);
+	void backlogSent();
+	bool needsPublish(const PublishField & field, const PublishedValue & published, int32_t value);
+	void continueDiscovery(unsigned long callStart);
+	bool publishDiscovery(const GoodWeCommunicator::GoodweInverterInformation & inverter, const PublishField & field);
+	int formatDiscoveryPart(int part, const PublishField & field, const char * serialNumber);
+	void countPublished(size_t topicLength, size_t payloadLength, bool qos1 = false);
+	bool handleConnection();
+	bool beginSession();
+	ConnectState checkSession();
 public:
-	MQTTPublisher(SettingsManager * settingsManager, GoodWeCommunicator *goodWe);
+	MQTTPublisher(SettingsManager * settingsManager, GoodWeCommunicator *goodWe, int brokerIndex = 0);
 	~MQTTPublisher();
 
 	void start();
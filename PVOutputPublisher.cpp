@@ -22,7 +22,15 @@ PVOutputPublisher::PVOutputPublisher(SettingsManager* settingsManager, GoodWeCom
 			return;
 		}
 
-		debugPrintln("PVOutputPublisher started.");
+		parseSystemMap();
+		//the backlogs of before a restart. Needs a flash layout with a file system
+		fileSystemMounted = LittleFS.begin();
+		if (!fileSystemMounted)
+			debugPrintln("No file system, the PVOutput backlog is not kept over a restart.");
+		for (auto & system : systems)
+			loadBacklog(system);
+		debugPrint("PVOutputPublisher started. Systems: ");
+		debugPrintln(systems.size());
 		lastUpdated = millis();
 		isStarted = true;
 	}
@@ -43,73 +51,345 @@ PVOutputPublisher::PVOutputPublisher(SettingsManager* settingsManager, GoodWeCom
 		return isStarted;
 	}
 
-	void PVOutputPublisher::sendToPvOutput(GoodWeCommunicator::GoodweInverterInformation info)
+	void PVOutputPublisher::parseSystemMap()
 	{
-		//need to send out the data to pvouptut> use the avg values for pac, voltage and temp
+		//the default system gets all inverters that are not mapped
+		systems.clear();
+		systemMappings.clear();
+		systems.push_back(PVOutputSystem());
+		systems[0].systemId = pvoutputSettings->pvoutputSystemId;
 
-		http.begin("http://pvoutput.org/service/r2/addstatus.jsp"); //Specify request destination
-		http.addHeader("X-Pvoutput-Apikey", pvoutputSettings->pvoutputApiKey);
-		http.addHeader("X-Pvoutput-SystemId", pvoutputSettings->pvoutputSystemId);
-		http.addHeader("Content-Type", "application/x-www-form-urlencoded");
+		//<serial>:<system id>, comma separated
+		auto & map = pvoutputSettings->pvoutputSystemMap;
+		int pos = 0;
+		while (pos < (int)map.length())
+		{
+			int end = map.indexOf(',', pos);
+			if (end < 0)
+				end = map.length();
+			String pair = map.substring(pos, end);
+			pos = end + 1;
+
+			int colon = pair.indexOf(':');
+			if (colon <= 0)
+				continue;
+			SystemMapping mapping;
+			mapping.serialNumber = pair.substring(0, colon);
+			mapping.serialNumber.trim();
+			String systemId = pair.substring(colon + 1);
+			systemId.trim();
+
+			//inverters mapped to the same system are added up
+			mapping.systemIndex = 0;
+			while (mapping.systemIndex < systems.size() && systems[mapping.systemIndex].systemId != systemId)
+				mapping.systemIndex++;
+			if (mapping.systemIndex == systems.size())
+			{
+				systems.push_back(PVOutputSystem());
+				systems.back().systemId = systemId;
+			}
+			systemMappings.push_back(mapping);
+		}
+
+		for (auto & system : systems)
+			system.backlog.reset(new circular_queue<StatusPoint, PVOUTPUT_BACKLOG_CAPACITY>());
+	}
+
+	size_t PVOutputPublisher::getSystemIndex(const char * serialNumber)
+	{
+		for (auto & mapping : systemMappings)
+		{
+			if (mapping.serialNumber == serialNumber)
+				return mapping.systemIndex;
+		}
+		return 0;
+	}
+
+	PVOutputPublisher::Aggregate PVOutputPublisher::aggregateInverters(size_t systemIndex)
+	{
+		Aggregate aggregate;
+		float weightSum = 0;
+		int onlineCount = 0;
+		auto & inverters = goodweCommunicator->getInvertersInfo();
+		for (auto & info : inverters)
+		{
+			if (getSystemIndex(info.serialNumber) != systemIndex)
+				continue;
+			//eday stays when an inverter goes offline, keep it in the total
+			aggregate.eDay += info.eDay;
+			if (!info.isOnline)
+				continue;
+
+			//weighted by power. Without any power all online inverters count the same
+			float weight = info.pac > 0 ? info.pac : 0;
+			aggregate.isOnline = true;
+			aggregate.pac += weight;
+			aggregate.iac1 += info.iac1;
+			aggregate.errorMessage |= info.errorMessage;
+			aggregate.voltage += (info.vpv1 + info.vpv2) * weight;
+			aggregate.temp += info.temp * weight;
+			aggregate.vac1 += info.vac1 * weight;
+			aggregate.fac1 += info.fac1 * weight;
+			aggregate.vpv1 += info.vpv1 * weight;
+			aggregate.vpv2 += info.vpv2 * weight;
+			weightSum += weight;
+			onlineCount++;
+		}
+		if (!onlineCount)
+			return aggregate;
+
+		if (weightSum == 0)
+		{
+			//no power: plain average of the online inverters
+			for (auto & info : inverters)
+			{
+				if (!info.isOnline || getSystemIndex(info.serialNumber) != systemIndex)
+					continue;
+				aggregate.voltage += info.vpv1 + info.vpv2;
+				aggregate.temp += info.temp;
+				aggregate.vac1 += info.vac1;
+				aggregate.fac1 += info.fac1;
+				aggregate.vpv1 += info.vpv1;
+				aggregate.vpv2 += info.vpv2;
+			}
+			weightSum = onlineCount;
+		}
+		aggregate.voltage /= weightSum;
+		aggregate.temp /= weightSum;
+		aggregate.vac1 /= weightSum;
+		aggregate.fac1 /= weightSum;
+		aggregate.vpv1 /= weightSum;
+		aggregate.vpv2 /= weightSum;
+		return aggregate;
+	}
+
+	void PVOutputPublisher::queueStatus(PVOutputSystem & system, const Aggregate & aggregate)
+	{
+		//the values of this interval go into the backlog first. use the avg values for pac, voltage and temp
 
 		//the inverter only reports eday with a .1 kWh resolution. This messus up the avg in pvoutput because the max resolution is 1200 Wh
 		//we now the avg power in the last period so we can calc the new eday and compare it
-		float eDay = info.eDay * 1000;
-		if (avgCounter)
+		float eDay = aggregate.eDay * 1000;
+		if (system.avgCounter)
 		{
-			float avgWhPower = (float)(currentPacSum / avgCounter) / (60.0 * 60 * 1000 / (float)(millis() - lastUpdated));
-			if (eDay - MAX_EDAY_DIFF < prevEday + avgWhPower && abs(prevEday + avgWhPower - eDay) < MAX_EDAY_DIFF) //when a new day starts the 'abs' part will reset to zero
-				eDay = prevEday + avgWhPower;
+			float avgWhPower = (float)(system.currentPacSum / system.avgCounter) / (60.0 * 60 * 1000 / (float)(millis() - lastUpdated));
+			if (eDay - MAX_EDAY_DIFF < system.prevEday + avgWhPower && abs(system.prevEday + avgWhPower - eDay) < MAX_EDAY_DIFF) //when a new day starts the 'abs' part will reset to zero
+				eDay = system.prevEday + avgWhPower;
 		}
-		prevEday = eDay;
-		//construct our post message
-		String postMsg = String("d=") + String(year()) + getZeroFilled(month()) + getZeroFilled(day());
-		postMsg += String("&t=") + getZeroFilled(hour()) + ":" + getZeroFilled(minute());
-		//v1 = total wh today
-		postMsg += String("&v1=") + String(eDay, 0); //TODO: improve resolution by adding avg power to prev val
+		system.prevEday = eDay;
 
-		//v2 = Power Generation
-		if (avgCounter) //no datapoints recorded
+		//full: drop the oldest point, the recent ones are worth more
+		if (!system.backlog->available_for_push())
+		{
+			system.backlog->commit_read(1);
+			system.backlogDropped++;
+		}
+		auto & point = system.backlog->pushpeek();
+		point.timestamp = now();
+		point.eDay = eDay;
+		point.pac = -1;
+		if (system.avgCounter) //no datapoints recorded
 		{
-
 			debugPrint("Got some readings to calculate the avg power, temp and voltage. # readings: ");
-			debugPrint(avgCounter);
+			debugPrint(system.avgCounter);
 			debugPrint(", pac sum: ");
-			debugPrintln(currentPacSum);
+			debugPrintln(system.currentPacSum);
 
+			point.pac = system.currentPacSum / system.avgCounter;
+			point.temp = system.currentTempSum / system.avgCounter;
+			point.voltage = system.currentVoltageSum / system.avgCounter;
+		}
+		point.vac1 = aggregate.vac1;
+		point.iac1 = aggregate.iac1;
+		point.fac1 = aggregate.fac1;
+		point.vpv1 = aggregate.vpv1;
+		point.vpv2 = aggregate.vpv2;
+		point.errorMessage = aggregate.errorMessage;
+		system.backlog->push();
+		system.backlogSaved = false;
+	}
 
-			postMsg += String("&v2=") + String(currentPacSum / avgCounter); //improve resolution by adding avg power to prev val
+	String PVOutputPublisher::formatStatus(const StatusPoint & point)
+	{
+		//d,t,v1,v2,v3,v4,v5,v6,v7..v12 of addbatchstatus
+		auto time = point.timestamp;
+		String status = String(year(time) * 10000UL + month(time) * 100 + day(time)) + "," + getZeroFilled(hour(time)) + ":" + getZeroFilled(minute(time));
+		//v1 = total wh today
+		status += "," + String(point.eDay);
+		if (point.pac >= 0)
+		{
+			//v2 = Power Generation, v3 and v4 are power consumption (maybe doable using mqtt?), v5 = temp, v6 = voltage
+			status += "," + String(point.pac) + ",,";
+			status += "," + String(point.temp, 2);
+			status += "," + String(point.voltage, 2);
+		}
+		else
+			status += ",,,,,";
+		//v7..v12 = custom 1..6 = vac1, iac1, fac1, vpv1, vpv2, errormsg
+		status += "," + String(point.vac1, 2);
+		status += "," + String(point.iac1, 2);
+		status += "," + String(point.fac1, 2);
+		status += "," + String(point.vpv1, 2);
+		status += "," + String(point.vpv2, 2);
+		status += "," + String((unsigned long)(uint32_t)point.errorMessage);
+		return status;
+	}
 
-			//v3 and v4 are power consumption (maybe doable using mqtt?)
-			//v5 = temp
-			postMsg += String("&v5=") + String(currentTempSum / avgCounter, 2);
-			//v6 = voltage
-			postMsg += String("&v6=") + String(currentVoltageSum / avgCounter, 2);
+	void PVOutputPublisher::trimBacklog(PVOutputSystem & system)
+	{
+		//pvoutput refuses points older than it accepts, after a long outage or restored from the backlog file
+		while (system.backlog->available() && now() - system.backlog->peek().timestamp > PVOUTPUT_MAX_POINT_AGE)
+		{
+			system.backlog->commit_read(1);
+			system.backlogDropped++;
+			system.backlogSaved = false;
 		}
+	}
 
-		//v7 = custom 1 = vac1
-		postMsg += String("&v7=") + String(info.vac1, 2);
-		//v8 = custom 2 = iac1
-		postMsg += String("&v8=") + String(info.iac1, 2);
-		//v9 = custom 3 = fac1
-		postMsg += String("&v9=") + String(info.fac1, 2);
-		//v10 = custom 4 = vpv1
-		postMsg += String("&v10=") + String(info.vpv1, 2);
-		//v11 = custom 5 = vpv2
-		postMsg += String("&v11=") + String(info.vpv2, 2);
-		//v12 = custom 6 = errormsg
-		postMsg += String("&v12=") + String(info.errorMessage);
+	void PVOutputPublisher::uploadBacklog(PVOutputSystem & system)
+	{
+		//the oldest points first. At the wrap around of the backlog the batch is cut short, the rest goes with the next one
+		const StatusPoint * points;
+		size_t count = system.backlog->peek_contiguous(points);
+		if (count > system.batchSize)
+			count = system.batchSize;
 
+		String postMsg = "data=";
+		postMsg.reserve(count * 80);
+		for (size_t cnt = 0; cnt < count; cnt++)
+		{
+			if (cnt)
+				postMsg += ";";
+			postMsg += formatStatus(points[cnt]);
+		}
+
+		http.begin("http://pvoutput.org/service/r2/addbatchstatus.jsp"); //Specify request destination
+		http.addHeader("X-Pvoutput-Apikey", pvoutputSettings->pvoutputApiKey);
+		http.addHeader("X-Pvoutput-SystemId", system.systemId);
+		http.addHeader("Content-Type", "application/x-www-form-urlencoded");
 		int httpCode = http.POST(postMsg); //Send the request
 		String payload = http.getString();  //Get the response payload
 		http.end();
+		system.lastUploadAttempt = millis();
 
+		debugPrint("System ");
+		debugPrint(system.systemId);
+		debugPrint(": ");
 		debugPrintln(postMsg);
 		debugPrint("Result: ");
 		debugPrintln(httpCode);
 		debugPrint("Payload: ");
 		debugPrintln(payload);
 
+		if (httpCode == 200)
+		{
+			system.backlog->commit_read(count);
+			system.backlogSaved = false;
+			system.retryInterval = 0;
+			if (!system.backlog->available())
+				system.batchSize = PVOUTPUT_BATCH_SIZE;
+			return;
+		}
+
+		//400: pvoutput refuses a point of the batch and will never take it. Split the batch until the point
+		//is found and drop only that one, the others are sent in the next calls
+		if (httpCode == 400)
+		{
+			system.retryInterval = 0;
+			if (count > 1)
+			{
+				system.batchSize = count / 2;
+				return;
+			}
+			system.backlog->commit_read(1);
+			system.backlogDropped++;
+			system.backlogSaved = false;
+			system.batchSize = PVOUTPUT_BATCH_SIZE;
+			return;
+		}
+
+		//not sent: keep the points and back off, the next intervals are added to the backlog meanwhile
+		system.retryInterval = system.retryInterval ? system.retryInterval * 2 : PVOUTPUT_RETRY_MIN_INTERVAL;
+		if (system.retryInterval > PVOUTPUT_RETRY_MAX_INTERVAL)
+			system.retryInterval = PVOUTPUT_RETRY_MAX_INTERVAL;
+		debugPrint("Upload failed, points in backlog: ");
+		debugPrint(system.backlog->available());
+		debugPrint(", dropped: ");
+		debugPrint(system.backlogDropped);
+		debugPrint(", retry in ms: ");
+		debugPrintln(system.retryInterval);
+	}
+
+	String PVOutputPublisher::backlogFileName(const PVOutputSystem & system)
+	{
+		return "/pvoutput_" + system.systemId + ".bin";
+	}
+
+	void PVOutputPublisher::loadBacklog(PVOutputSystem & system)
+	{
+		if (!fileSystemMounted)
+			return;
+		File file = LittleFS.open(backlogFileName(system), "r");
+		if (!file)
+			return;
+		system.hasBacklogFile = true;
+		BacklogFileHeader header;
+		if (file.read(reinterpret_cast<uint8_t*>(&header), sizeof(header)) != sizeof(header) ||
+			header.magic != PVOUTPUT_BACKLOG_FILE_MAGIC || header.version != PVOUTPUT_BACKLOG_FILE_VERSION)
+		{
+			//other layout, the points can not be read. The file is replaced with the next save
+			file.close();
+			system.backlogSaved = false;
+			return;
+		}
+		for (uint16_t cnt = 0; cnt < header.count && system.backlog->available_for_push(); cnt++)
+		{
+			auto & point = system.backlog->pushpeek();
+			if (file.read(reinterpret_cast<uint8_t*>(&point), sizeof(point)) != sizeof(point))
+				break;
+			system.backlog->push();
+		}
+		file.close();
+		debugPrint("System ");
+		debugPrint(system.systemId);
+		debugPrint(": points restored from the backlog file: ");
+		debugPrintln(system.backlog->available());
+	}
+
+	void PVOutputPublisher::saveBacklog(PVOutputSystem & system)
+	{
+		//written while uploads fail, so the points survive a restart. Rewritten while the file is there, removed once all is sent
+		if (!fileSystemMounted || system.backlogSaved)
+			return;
+		if (!system.backlog->available())
+		{
+			if (system.hasBacklogFile)
+				LittleFS.remove(backlogFileName(system));
+			system.hasBacklogFile = false;
+			system.backlogSaved = true;
+			return;
+		}
+		if (!system.retryInterval && !system.hasBacklogFile)
+			return;
+
+		File file = LittleFS.open(backlogFileName(system), "w");
+		if (!file)
+		{
+			debugPrintln("Could not write the PVOutput backlog file.");
+			return;
+		}
+		BacklogFileHeader header = { PVOUTPUT_BACKLOG_FILE_MAGIC, PVOUTPUT_BACKLOG_FILE_VERSION, (uint16_t)system.backlog->available() };
+		file.write(reinterpret_cast<const uint8_t*>(&header), sizeof(header));
+		//every point once around the queue, it ends up in the same order
+		for (size_t cnt = header.count; cnt; cnt--)
+		{
+			auto point = system.backlog->pop();
+			file.write(reinterpret_cast<const uint8_t*>(&point), sizeof(point));
+			system.backlog->push(std::move(point));
+		}
+		file.close();
+		system.hasBacklogFile = true;
+		system.backlogSaved = true;
 	}
 
 	String PVOutputPublisher::getZeroFilled(int num)
@@ -121,63 +401,73 @@ PVOutputPublisher::PVOutputPublisher(SettingsManager* settingsManager, GoodWeCom
 	{
 		if (!isStarted)
 			return;
-		//check if time elapsed and we need to send the current values
-		//lastUpdated. For now we only support one inverter
-		auto inverters = goodweCommunicator->getInvertersInfo();
-		if (inverters.size() > 0)
+		//check if time elapsed and we need to send the current values of every system
+		bool sendNow = millis() - lastUpdated > pvoutputSettings->pvoutputUpdateInterval;
+		for (auto & system : systems)
 		{
+			auto aggregate = aggregateInverters(&system - &systems[0]);
 
 			//check if we need to send the info to pvoutptut.
 			//if not check if the pac value changed add it to the current sum so we can calc the average on sending
-			if (wasOnline && millis() - lastUpdated > pvoutputSettings->pvoutputUpdateInterval)
+			if (sendNow)
 			{
-				//send it out
-				sendToPvOutput(inverters[0]);
-				ResetAverage();
-				lastUpdated = millis();
+				if (!system.wasOnline)
+					continue;
+				//queue it, it is sent out below
+				queueStatus(system, aggregate);
+				ResetAverage(system);
 
-				if (!inverters[0].isOnline && wasOnline)
+				if (!aggregate.isOnline)
 				{
 					//went offline. Data was sent for the last time
-					wasOnline = false;
-					//cleaar all avg data first
-					ResetAverage();
+					system.wasOnline = false;
 				}
 			}
 			else
 			{
-				//keep track of when the inverter went offline
-				if (!wasOnline && inverters[0].isOnline)
+				//keep track of when the inverters went offline
+				if (!system.wasOnline && aggregate.isOnline)
 				{
-					wasOnline = true;
+					system.wasOnline = true;
 					//cleaar all avg data first
-					ResetAverage();
+					ResetAverage(system);
 				}
 
 				//check if inverter info was updated
-				if (inverters[0].isOnline && (inverters[0].pac != lastPac || inverters[0].vpv1 + inverters[0].vpv2 != lastVoltage || inverters[0].temp != lastTemp))
+				if (aggregate.isOnline && (aggregate.pac != system.lastPac || aggregate.voltage != system.lastVoltage || aggregate.temp != system.lastTemp))
 				{
 					//changed. so change the avg counters
-					lastPac = inverters[0].pac;
-					lastVoltage = inverters[0].vpv1 + inverters[0].vpv2;
-					lastTemp = inverters[0].temp;
-					currentPacSum += lastPac;
-					currentVoltageSum += lastVoltage;
-					currentTempSum += lastTemp;
-					avgCounter += 1;
+					system.lastPac = aggregate.pac;
+					system.lastVoltage = aggregate.voltage;
+					system.lastTemp = aggregate.temp;
+					system.currentPacSum += system.lastPac;
+					system.currentVoltageSum += system.lastVoltage;
+					system.currentTempSum += system.lastTemp;
+					system.avgCounter += 1;
 				}
 			}
 		}
+		if (sendNow)
+			lastUpdated = millis();
+
+		//upload the backlog, a batch per call. After a failure wait for the retry interval
+		for (auto & system : systems)
+		{
+			trimBacklog(system);
+			if (system.backlog->available() && (!system.retryInterval || millis() - system.lastUploadAttempt >= system.retryInterval))
+				uploadBacklog(system);
+			saveBacklog(system);
+		}
 	}
 
-	void PVOutputPublisher::ResetAverage()
+	void PVOutputPublisher::ResetAverage(PVOutputSystem & system)
 	{
 		//reset counter vals
-		avgCounter = 0;
-		currentPacSum = 0;
-		currentVoltageSum = 0;
-		currentTempSum = 0;
-		lastPac = 0;
-		lastVoltage = 0;
-		lastTemp = 0;
+		system.avgCounter = 0;
+		system.currentPacSum = 0;
+		system.currentVoltageSum = 0;
+		system.currentTempSum = 0;
+		system.lastPac = 0;
+		system.lastVoltage = 0;
+		system.lastTemp = 0;
 	}
@@ -5,9 +5,20 @@
 #include "SettingsManager.h"
 #include "GoodWeCommunicator.h"
 #include "ESP8266HTTPClient.h"
+#include <LittleFS.h>
 #include "Debug.h"
+#include "circular_queue/circular_queue.h"
+#include <vector>
+#include <memory>
 
 #define MAX_EDAY_DIFF 100.0f
+#define PVOUTPUT_BACKLOG_CAPACITY 64			//status points kept per system while pvoutput is unreachable (power of two), about 50 bytes each
+#define PVOUTPUT_BATCH_SIZE 30					//status points per addbatchstatus request, the pvoutput maximum
+#define PVOUTPUT_RETRY_MIN_INTERVAL 60000		//ms before retrying a failed upload, doubled on every failure
+#define PVOUTPUT_RETRY_MAX_INTERVAL (30 * 60 * 1000UL)
+#define PVOUTPUT_MAX_POINT_AGE (14 * 24 * 3600L)	//seconds, older status points are refused by addbatchstatus
+#define PVOUTPUT_BACKLOG_FILE_MAGIC 0x42565050		//"PPVB", first bytes of /pvoutput_<system id>.bin
+#define PVOUTPUT_BACKLOG_FILE_VERSION 1			//increase when StatusPoint changes, older files are ignored
 
 class PVOutputPublisher
 {
@@ -19,28 +30,98 @@ public:
 	void stop();
 	bool canStart();
 	bool getIsStarted();
-	void sendToPvOutput(GoodWeCommunicator::GoodweInverterInformation info);
 
 	void handle();
 
-	void ResetAverage();
-
 private:
+	//the inverters of a pvoutput system combined into one. Power and eday are summed, the other values weighted by power
+	struct Aggregate
+	{
+		bool isOnline = false;		//at least one inverter of the system online
+		unsigned int pac = 0;
+		float eDay = 0;
+		float voltage = 0;			//vpv1 + vpv2
+		float temp = 0;
+		float vac1 = 0;
+		float iac1 = 0;				//summed
+		float fac1 = 0;
+		float vpv1 = 0;
+		float vpv2 = 0;
+		int errorMessage = 0;		//error bits of all inverters
+	};
+
+	//the values of one upload interval, kept until pvoutput accepted them
+	struct StatusPoint
+	{
+		time_t timestamp;			//local time of the interval, as set for pvoutput
+		unsigned long eDay;			//Wh
+		long pac;					//-1: no readings, pac, temp and voltage are left out
+		float temp;
+		float voltage;
+		float vac1;
+		float iac1;
+		float fac1;
+		float vpv1;
+		float vpv2;
+		int errorMessage;
+	};
+
+	//a pvoutput system and the averages of its inverters since the last upload
+	struct PVOutputSystem
+	{
+		String systemId;
+		unsigned long currentPacSum = 0;
+		unsigned int lastPac = 0;
+		float lastVoltage = 0;
+		double currentVoltageSum = 0;
+		float lastTemp = 0;
+		double currentTempSum = 0;
+		unsigned long avgCounter = 0;
+		bool wasOnline = false;
+		float prevEday = 0.0f;
+		std::unique_ptr<circular_queue<StatusPoint, PVOUTPUT_BACKLOG_CAPACITY>> backlog;
+		unsigned long backlogDropped = 0;
+		unsigned long lastUploadAttempt = 0;
+		unsigned long retryInterval = 0;	//0: last upload succeeded
+		size_t batchSize = PVOUTPUT_BATCH_SIZE;	//halved on every 400 until the point pvoutput refuses is found
+		bool backlogSaved = true;			//the backlog file has the points of the backlog
+		bool hasBacklogFile = false;
+	};
+
+	//start of the backlog file, the points follow as they are in memory
+	struct BacklogFileHeader
+	{
+		uint32_t magic;
+		uint16_t version;
+		uint16_t count;
+	};
+
+	//inverter serial number mapped to a system other than the default one
+	struct SystemMapping
+	{
+		String serialNumber;
+		size_t systemIndex;
+	};
+
 	SettingsManager::Settings * pvoutputSettings;
 	SettingsManager * pvOutputSettingsManager;
 	GoodWeCommunicator * goodweCommunicator;
 	unsigned long lastUpdated;
 	bool isStarted = false;	 
-	unsigned long currentPacSum = 0;
-	unsigned int lastPac = 0;
-	float lastVoltage = 0;
-	double currentVoltageSum = 0;
-	float lastTemp;
-	double currentTemp = 0;
-	double currentTempSum = 0;
-	unsigned long avgCounter = 0;
-	bool wasOnline = false;
-	float prevEday = 0.0f;
+	bool fileSystemMounted = false;				//LittleFS available to keep the backlogs over a restart
+	std::vector<PVOutputSystem> systems;			//the first is PVOUTPUT_SYSTEM_ID, for all inverters not mapped
+	std::vector<SystemMapping> systemMappings;
 	String getZeroFilled(int num);
+	void parseSystemMap();
+	size_t getSystemIndex(const char * serialNumber);
+	Aggregate aggregateInverters(size_t systemIndex);
+	void queueStatus(PVOutputSystem & system, const Aggregate & aggregate);
+	void trimBacklog(PVOutputSystem & system);
+	void uploadBacklog(PVOutputSystem & system);
+	String backlogFileName(const PVOutputSystem & system);
+	void loadBacklog(PVOutputSystem & system);
+	void saveBacklog(PVOutputSystem & system);
+	String formatStatus(const StatusPoint & point);
+	void ResetAverage(PVOutputSystem & system);
 };
 
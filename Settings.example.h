@@ -16,18 +16,42 @@
 //password for above user
 #define MQTT_PASSWORD   "<mqtt password>"
 
+//a second mqtt broker that gets the same data, e.g. a cloud broker next to a local one. Leave empty to disable
+#define MQTT_HOST_NAME_2  ""
+#define MQTT_PORT_2       1883
+#define MQTT_USER_NAME_2  ""
+#define MQTT_PASSWORD_2   ""
+
 //update interval for fast changing values in milliseconds for mqtt
 #define MQTT_QUICK_UPDATE_INTERVAL  10000
 
 //update interval for slow changing values in milliseconds for mqtt
 #define MQTT_REGULAR_UPDATE_INTERVAL  60000
 
+//publish all values of an inverter as one json document on goodwe/<serial>/state instead of a topic per value
+#define MQTT_JSON_MODE  false
+
+//publish all values of an inverter as a compact MessagePack sample on goodwe/<serial>/bin instead, for metered
+//connections. Decode them with tools/goodwe_decode.py. Overrides MQTT_JSON_MODE, no home assistant discovery
+#define MQTT_BINARY_MODE  false
+
+//publish a value only when it changed more than its deadband, or was not published for this many milliseconds.
+//For example 300000 (5 minutes), max 16 hours. Set to 0 to publish every value every update interval
+#define MQTT_MAX_AGE  0
+
+//publish retained home assistant mqtt discovery configs (homeassistant/sensor/...) for the values of every inverter
+#define MQTT_HOME_ASSISTANT_DISCOVERY  false
+
 //set to your pvoutput api key (must have write rights). Leave empty to disable pvoutput publishing
 #define PVOUTPUT_API_KEY  "<your api key for pvoutput>"
 
-//set to the pvoutput system id to update. Only the first inverter is supported for now
+//set to the pvoutput system id to update. With more inverters their production is added up
 #define PVOUTPUT_SYSTEM_ID  "<pvoutput system id>"
 
+//optional: upload inverters to their own pvoutput system, e.g. for separate arrays. Comma separated
+//<serial number>:<system id> pairs, like "93600DVA295R148:12345,93600DVA295R149:12346". Leave empty to add up all inverters
+#define PVOUTPUT_SYSTEM_MAP  ""
+
 //how long between pvoutput updates. Pvoutput specifies a minimum of 5 minutes (5*60*1000)
 #define PVOUTPUT_UPDATE_INTERVAL   5 * 60 * 1000
 
@@ -40,6 +64,10 @@
 //rs485 transmit pin
 #define RS485_TX D2
 
+//rs485 baud rate. GoodWe inverters use 9600. Set to 0 to detect it automatically during discovery (2400 to 57600 baud),
+//detection restarts when no valid packets are received at the detected rate
+#define RS485_BAUD_RATE 9600
+
 //Hostname to use on local network
 #define WIFI_HOSTNAME "GoodWeLogger"
 
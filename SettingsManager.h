@@ -1,23 +1,35 @@
 #pragma once
 #include <ESP8266WiFi.h>
 
+#define MQTT_BROKER_COUNT 2		//brokers the mqtt data is published to, each with its own connection
+
 class SettingsManager
 {
 public:
+	struct MqttBroker
+	{
+		String hostName;		//empty: not used
+		int port;
+		String userName;		//empty: no authentication
+		String password;
+	};
+
 	struct Settings
 	{
 	public:
 		//mqtt settings
-		String mqttHostName;
-		int mqttPort;
-		String mqttUserName;
-		String mqttPassword;
+		MqttBroker mqttBrokers[MQTT_BROKER_COUNT];
 		int mqttQuickUpdateInterval;
 		int mqttRegularUpdateInterval;
+		bool mqttJsonMode = false;		//all values of an inverter in one json document on goodwe/<serial>/state
+		bool mqttBinaryMode = false;	//all values of an inverter as a MessagePack sample on goodwe/<serial>/bin
+		bool mqttHomeAssistantDiscovery = false;	//publish retained home assistant discovery configs for the inverter values
+		int mqttMaxAge = 0;				//publish on change: max ms a value is not published. 0 = publish every value every interval
 
 		//pvoutput settings
 		String pvoutputApiKey;
 		String pvoutputSystemId;
+		String pvoutputSystemMap;		//<serial>:<system id> pairs, comma separated. Other inverters go to pvoutputSystemId
 		int pvoutputUpdateInterval;
 
 		//wifi settings
@@ -29,6 +41,7 @@ public:
 		//general settings
 		int RS485Rx =D1;		//default set because added later
 		int RS485Tx =D2;
+		int RS485BaudRate = 9600;	//0 = detect the inverter baud rate automatically
 		int inverterOfflineDataResetTimeout;
 		int timezone;
 
@@ -30,6 +30,14 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 
 constexpr uint8_t BYTE_ALL_BITS_SET = ~static_cast<uint8_t>(0);
 
+// true if the number of set bits in byte is odd
+static inline bool parityOdd(uint8_t byte) {
+    byte ^= byte >> 4;
+    byte ^= byte >> 2;
+    byte ^= byte >> 1;
+    return byte & 1;
+}
+
 SoftwareSerial52::SoftwareSerial52() {
     m_isrOverflow = false;
 }
@@ -59,20 +67,24 @@ bool SoftwareSerial52::isValidGPIOpin(int8_t pin) {
 
 void SoftwareSerial52::begin(uint32_t baud, SoftwareSerial52Config config,
     int8_t rxPin, int8_t txPin,
-    bool invert, int bufCapacity, int isrBufCapacity) {
+    bool invert) {
     if (-1 != rxPin) m_rxPin = rxPin;
     if (-1 != txPin) m_txPin = txPin;
     m_oneWire = (m_rxPin == m_txPin);
     m_invert = invert;
+    m_dataBits = 5 + (config & 0x03);
+    m_parityMode = static_cast<SoftwareSerial52Parity>((config >> 2) & 0x03);
+    m_pduBits = m_dataBits + (m_parityMode != SWSERIAL_PARITY_NONE ? 1 : 0);
+    m_stopBits = (config & 0x10) ? 2 : 1;
+    m_stats = SoftwareSerial52Stats();
     if (isValidGPIOpin(m_rxPin)) {
-        std::unique_ptr<circular_queue<uint8_t> > buffer(new circular_queue<uint8_t>((bufCapacity > 0) ? bufCapacity : 64));
-        m_buffer = move(buffer);
-        std::unique_ptr<circular_queue<uint32_t> > isrBuffer(new circular_queue<uint32_t>((isrBufCapacity > 0) ? isrBufCapacity : (sizeof(uint8_t) * 8 + 2) * bufCapacity));
-        m_isrBuffer = move(isrBuffer);
-        if (m_buffer != 0 && m_isrBuffer != 0) {
-            m_rxValid = true;
-            pinMode(m_rxPin, INPUT_PULLUP);
-        }
+        m_buffer.flush();
+        m_rxTimestamps.flush();
+        m_rxLineErrors.flush();
+        m_rxPendingLineErrors = 0;
+        m_isrBuffer.flush();
+        m_rxValid = true;
+        pinMode(m_rxPin, INPUT_PULLUP);
     }
     if (isValidGPIOpin(m_txPin)
 #ifdef ESP8266
@@ -87,10 +99,9 @@ void SoftwareSerial52::begin(uint32_t baud, SoftwareSerial52Config config,
         }
     }
 
-    m_dataBits = 5 + config;
-    m_bit_us = (1000000 + baud / 2) / baud;
-    m_bitCycles = (ESP.getCpuFreqMHz() * 1000000 + baud / 2) / baud;
     m_intTxEnabled = true;
+    m_autoBaudEdges = 0;
+    setBaudRate(baud);
     if (!m_rxEnabled) { enableRx(true); }
 }
 
@@ -98,18 +109,97 @@ void SoftwareSerial52::end()
 {
     enableRx(false);
     m_txValid = false;
-    if (m_buffer) {
-        m_buffer.reset();
-    }
-    if (m_isrBuffer) {
-        m_isrBuffer.reset();
-    }
+    m_rxValid = false;
 }
 
 uint32_t SoftwareSerial52::baudRate() {
     return ESP.getCpuFreqMHz() * 1000000 / m_bitCycles;
 }
 
+void SoftwareSerial52::setBaudRate(uint32_t baud) {
+    const bool rxEnabled = m_rxEnabled;
+    // the RX ISR depends on the bitrate, and the pending edges are decoded at the old one
+    if (rxEnabled) { enableRx(false); }
+    setBitCycles(baud);
+    if (rxEnabled) { enableRx(true); }
+}
+
+void SoftwareSerial52::setBitCycles(uint32_t baud) {
+    m_bit_us = (1000000 + baud / 2) / baud;
+    m_bitCycles = (ESP.getCpuFreqMHz() * 1000000 + baud / 2) / baud;
+}
+
+void SoftwareSerial52::startAutoBaud(uint16_t edges) {
+    if (!m_rxValid || !edges) return;
+    const bool rxEnabled = m_rxEnabled;
+    if (rxEnabled) { enableRx(false); }
+    // edges received at the old bitrate are of no use
+    m_isrBuffer.flush();
+    m_autoBaudCount = 0;
+    m_autoBaudEdges = edges;
+    m_autoBaudDetected = false;
+    // the measurement needs every edge, that is the CHANGE ISR
+    if (rxEnabled) { enableRx(true); }
+}
+
+void SoftwareSerial52::stopAutoBaud() {
+    if (!m_autoBaudEdges) return;
+    const bool rxEnabled = m_rxEnabled;
+    if (rxEnabled) { enableRx(false); }
+    m_autoBaudEdges = 0;
+    // back to the ISR of the current bitrate, without the measured edges
+    if (rxEnabled) { enableRx(true); }
+}
+
+void SoftwareSerial52::autoBaudEdge(uint32_t isrCycle) {
+    static const uint32_t standardRates[] = {
+        1200, 2400, 4800, 9600, 14400, 19200, 28800, 38400, 57600
+    };
+    const uint32_t cpuHz = ESP.getCpuFreqMHz() * 1000000U;
+    const uint32_t cycles = isrCycle - m_isrLastCycle;
+    m_isrLastCycle = isrCycle;
+
+    // glitches shorter than a bit at 4 times the highest rate are ignored
+    if (cycles < cpuHz / (SWSERIAL52_AUTOBAUD_MAX_RATE * 4)) return;
+    if (cycles < cpuHz / (SWSERIAL52_AUTOBAUD_MAX_RATE + SWSERIAL52_AUTOBAUD_MAX_RATE / 10)) {
+        // bits faster than the CHANGE ISR follows, longer intervals would be taken for bits.
+        // Give up, rxBits() restarts RX at the current bitrate
+        m_autoBaudEdges = 0;
+        detachInterrupt(digitalPinToInterrupt(m_rxPin));
+        m_rxEnabled = false;
+        return;
+    }
+    if (!m_autoBaudCount || cycles < m_autoBaudMin / 3 * 2) {
+        // much shorter than any interval so far, the longer ones were multiple bits
+        m_autoBaudMin = cycles;
+        m_autoBaudSum = cycles;
+        m_autoBaudCount = 1;
+    }
+    else if (cycles < m_autoBaudMin + m_autoBaudMin / 2) {
+        // a single bit, average out the ISR latency jitter
+        if (cycles < m_autoBaudMin) m_autoBaudMin = cycles;
+        m_autoBaudSum += cycles;
+        ++m_autoBaudCount;
+    }
+    if (--m_autoBaudEdges) return;
+
+    uint32_t baud = (cpuHz + m_autoBaudSum / m_autoBaudCount / 2) / (m_autoBaudSum / m_autoBaudCount);
+    // snap to the nearest standard rate if within 10 %, else keep the measured rate
+    for (uint32_t rate : standardRates) {
+        if (baud >= rate - rate / 10 && baud <= rate + rate / 10) {
+            baud = rate;
+            break;
+        }
+    }
+    m_autoBaudDetected = true;
+    m_rxCurByte = 0;
+    // called from rxBits(), stop RX without decoding. rxBits() restarts it
+    // once the pending edges are dropped
+    detachInterrupt(digitalPinToInterrupt(m_rxPin));
+    m_rxEnabled = false;
+    setBitCycles(baud);
+}
+
 void SoftwareSerial52::setTransmitEnablePin(int8_t txEnablePin) {
     if (isValidGPIOpin(txEnablePin)) {
         m_txEnableValid = true;
@@ -143,16 +233,26 @@ void SoftwareSerial52::enableTx(bool on) {
 void SoftwareSerial52::enableRx(bool on) {
     if (m_rxValid) {
         if (on) {
-            m_rxCurBit = m_dataBits;
+            if (m_rxEnabled) { enableRx(false); }
+            // edges not decoded when RX was stopped belong to an auto-baud measurement,
+            // and they are relative to the delta base reset below
+            m_isrBuffer.flush();
+            m_rxCurBit = m_pduBits;
             // Init to stop bit level and current cycle
             m_isrLastCycle = (ESP.getCycleCount() | 1) ^ m_invert;
-            if (m_bitCycles >= (ESP.getCpuFreqMHz() * 1000000U) / 74880U)
+#ifdef SWSERIAL52_ISR_DELTA16
+            m_isrEncodeCycle = m_isrDecodeCycle = m_isrLastCycle;
+            m_isrEscape = 0;
+#endif
+            if (m_autoBaudEdges || m_bitCycles >= (ESP.getCpuFreqMHz() * 1000000U) / 74880U)
                 attachInterruptArg(digitalPinToInterrupt(m_rxPin), reinterpret_cast<void (*)(void*)>(rxBitISR), this, CHANGE);
             else
                 attachInterruptArg(digitalPinToInterrupt(m_rxPin), reinterpret_cast<void (*)(void*)>(rxBitSyncISR), this, m_invert ? RISING : FALLING);
         }
         else {
             detachInterrupt(digitalPinToInterrupt(m_rxPin));
+            // decode the captured edges with the settings and delta base they were recorded at
+            if (m_rxEnabled && !m_autoBaudEdges) { rxBits(); }
         }
         m_rxEnabled = on;
     }
@@ -160,25 +260,50 @@ void SoftwareSerial52::enableRx(bool on) {
 
 int SoftwareSerial52::read() {
     if (!m_rxValid) { return -1; }
-    if (!m_buffer->available()) {
+    if (!m_buffer.available()) {
         rxBits();
-        if (!m_buffer->available()) { return -1; }
+        if (!m_buffer.available()) { return -1; }
     }
-    return m_buffer->pop();
+    m_rxTimestamps.pop();
+    m_rxLineErrors.pop();
+    return m_buffer.pop();
 }
 
 size_t SoftwareSerial52::readBytes(uint8_t * buffer, size_t size) {
     if (!m_rxValid) { return -1; }
-    if (0 != (size = m_buffer->pop_n(buffer, size))) return size;
-    rxBits();
-    size = m_buffer->pop_n(buffer, size);
+    if (!m_buffer.available()) { rxBits(); }
+    size = m_buffer.pop_n(buffer, size);
+    m_rxTimestamps.pop_n(nullptr, size);
+    m_rxLineErrors.pop_n(nullptr, size);
     return (size == 0) ? -1 : size;
 }
 
+size_t SoftwareSerial52::peekContiguous(const uint8_t * &data) {
+    if (!m_rxValid) { return 0; }
+    rxBits();
+    return m_buffer.peek_contiguous(data);
+}
+
+size_t SoftwareSerial52::peekContiguous(const uint8_t * &data, const uint32_t * &timestamps) {
+    if (!m_rxValid) { return 0; }
+    rxBits();
+    // same capacity and same push/pop sequence, so the blocks line up
+    m_rxTimestamps.peek_contiguous(timestamps);
+    return m_buffer.peek_contiguous(data);
+}
+
+size_t SoftwareSerial52::peekContiguous(const uint8_t * &data, const uint32_t * &timestamps, const uint8_t * &lineErrors) {
+    if (!m_rxValid) { return 0; }
+    rxBits();
+    m_rxTimestamps.peek_contiguous(timestamps);
+    m_rxLineErrors.peek_contiguous(lineErrors);
+    return m_buffer.peek_contiguous(data);
+}
+
 int SoftwareSerial52::available() {
     if (!m_rxValid) { return 0; }
     rxBits();
-    int avail = m_buffer->available();
+    int avail = m_buffer.available();
     if (!avail) {
         optimistic_yield(10000);
     }
@@ -245,16 +370,23 @@ size_t ICACHE_RAM_ATTR SoftwareSerial52::write(const uint8_t * buffer, size_t si
     }
     resetPeriodStart();
     const uint32_t dataMask = ((1UL << m_dataBits) - 1);
+    const int frameBits = 1 + m_pduBits + m_stopBits;
+    const uint32_t frameMask = ((1UL << frameBits) - 1);
     for (size_t cnt = 0; cnt < size; ++cnt, ++buffer) {
         bool withStopBit = true;
-        // push LSB start-data-stop bit pattern into uint32_t
-        // Stop bit : LOW if inverted logic, otherwise HIGH
-        uint32_t word = (!m_invert) << m_dataBits;
-        word |= (m_invert ? ~*buffer : *buffer) & dataMask;
-        // Start bit : HIGH if inverted logic, otherwise LOW
+        // push LSB start-data-parity-stop bit pattern into uint32_t
+        const uint8_t data = *buffer & dataMask;
+        // Stop bits : HIGH
+        uint32_t word = ((1UL << m_stopBits) - 1) << m_pduBits;
+        word |= data;
+        if (m_parityMode != SWSERIAL_PARITY_NONE) {
+            word |= static_cast<uint32_t>(parityOdd(data) ^ (m_parityMode == SWSERIAL_PARITY_ODD)) << m_dataBits;
+        }
+        // Start bit : LOW
         word <<= 1;
-        word |= m_invert;
-        for (int i = 0; i < m_dataBits + 2; ++i) {
+        // all levels are swapped for inverted logic
+        if (m_invert) { word = ~word & frameMask; }
+        for (int i = 0; i < frameBits; ++i) {
             bool pb = b;
             b = (word >> i) & 1;
             if (!pb && b) {
@@ -283,7 +415,10 @@ size_t ICACHE_RAM_ATTR SoftwareSerial52::write(const uint8_t * buffer, size_t si
 
 void SoftwareSerial52::flush() {
     if (!m_rxValid) { return; }
-    m_buffer->flush();
+    m_buffer.flush();
+    m_rxTimestamps.flush();
+    m_rxLineErrors.flush();
+    m_rxPendingLineErrors = 0;
 }
 
 bool SoftwareSerial52::overflow() {
@@ -294,15 +429,14 @@ bool SoftwareSerial52::overflow() {
 
 int SoftwareSerial52::peek() {
     if (!m_rxValid) { return -1; }
-    if (!m_buffer->available()) {
+    if (!m_buffer.available()) {
         rxBits();
-        if (!m_buffer->available()) return -1;
+        if (!m_buffer.available()) return -1;
     }
-    return m_buffer->peek();
+    return m_buffer.peek();
 }
 
 void SoftwareSerial52::rxBits() {
-    int isrAvail = m_isrBuffer->available();
 #ifdef ESP8266
     if (m_isrOverflow.load()) {
         m_overflow = true;
@@ -314,25 +448,101 @@ void SoftwareSerial52::rxBits() {
     }
 #endif
 
+    // decode the edges in place, in at most two blocks
+    const IsrEntry* isrEntries;
+    size_t isrBlock;
+    while ((isrBlock = m_isrBuffer.peek_contiguous(isrEntries)) > 0) {
+        const bool autoBaud = m_autoBaudEdges > 0;
+        for (size_t i = 0; i < isrBlock; ++i) {
+            rxIsrEntry(isrEntries[i]);
+            if (autoBaud && !m_autoBaudEdges) break;
+        }
+        if (autoBaud && !m_autoBaudEdges) {
+            // measurement complete or abandoned, RX is stopped. Restart it at the new bitrate,
+            // in the bitrate's ISR mode, without the remaining edges, they are part of the discarded data
+            m_isrBuffer.flush();
+            enableRx(true);
+            break;
+        }
+        m_isrBuffer.commit_read(isrBlock);
+    }
+
     // stop bit can go undetected if leading data bits are at same level
     // and there was also no next start bit yet, so one byte may be pending.
-    // low-cost check first
-    if (!isrAvail && m_rxCurBit >= -1 && m_rxCurBit < m_dataBits) {
-        uint32_t detectionCycles = (m_dataBits - m_rxCurBit) * m_bitCycles;
+    // checked after decoding, the last edge may have been in the buffer
+    if (!m_autoBaudEdges && m_rxCurBit >= -1 && m_rxCurBit < m_pduBits && !m_isrBuffer.available()) {
+        uint32_t detectionCycles = (m_pduBits - m_rxCurBit) * m_bitCycles;
         if (ESP.getCycleCount() - m_isrLastCycle > detectionCycles) {
             // Produce faux stop bit level, prevents start bit maldetection
             // cycle's LSB is repurposed for the level bit
             rxBits(((m_isrLastCycle + detectionCycles) | 1) ^ m_invert);
         }
     }
+}
 
-    m_isrBuffer->for_each([this](const uint32_t& isrCycle) { rxBits(isrCycle); });
+#ifdef SWSERIAL52_ISR_DELTA16
+void SoftwareSerial52::rxIsrEntry(IsrEntry entry) {
+    // same arithmetic as isrPushEdge, so m_isrDecodeCycle follows m_isrEncodeCycle exactly
+    if (m_isrEscape) {
+        if (--m_isrEscape) {
+            m_isrDecodeCycle = static_cast<uint32_t>(entry) << 16;
+            return;
+        }
+        m_isrDecodeCycle |= entry;
+        rxBits((m_isrDecodeCycle & ~1U) | m_isrEscapeLevel);
+        return;
+    }
+    if ((entry >> 1) == ISR_DELTA_ESCAPE) {
+        m_isrEscape = 2;
+        m_isrEscapeLevel = entry & 1;
+        return;
+    }
+    m_isrDecodeCycle += static_cast<uint32_t>(entry >> 1) << ISR_DELTA_SHIFT;
+    rxBits((m_isrDecodeCycle & ~1U) | (entry & 1));
 }
 
+inline void ICACHE_RAM_ATTR SoftwareSerial52::isrPushEdge(SoftwareSerial52 * self, uint32_t cycle, bool level) {
+    const uint32_t delta = (cycle - self->m_isrEncodeCycle) >> ISR_DELTA_SHIFT;
+    if (delta < ISR_DELTA_ESCAPE) {
+        if (!self->m_isrBuffer.push(static_cast<uint16_t>((delta << 1) | level))) {
+            self->m_isrOverflow.store(true);
+            return;
+        }
+        // advance by the stored delta only, the truncation error does not accumulate
+        self->m_isrEncodeCycle += delta << ISR_DELTA_SHIFT;
+        return;
+    }
+    // escape and absolute cycle must be stored together
+    if (self->m_isrBuffer.available_for_push() < 3) {
+        self->m_isrOverflow.store(true);
+        return;
+    }
+    self->m_isrBuffer.push(static_cast<uint16_t>((ISR_DELTA_ESCAPE << 1) | level));
+    self->m_isrBuffer.push(static_cast<uint16_t>(cycle >> 16));
+    self->m_isrBuffer.push(static_cast<uint16_t>(cycle));
+    self->m_isrEncodeCycle = cycle;
+}
+#else
+void SoftwareSerial52::rxIsrEntry(IsrEntry entry) {
+    rxBits(entry);
+}
+
+inline void ICACHE_RAM_ATTR SoftwareSerial52::isrPushEdge(SoftwareSerial52 * self, uint32_t cycle, bool level) {
+    // Store level and cycle in the buffer unless we have an overflow
+    // cycle's LSB is repurposed for the level bit
+    if (!self->m_isrBuffer.push((cycle | 1U) ^ !level)) self->m_isrOverflow.store(true);
+}
+#endif
+
 void SoftwareSerial52::rxBits(const uint32_t & isrCycle) {
+    if (m_autoBaudEdges) {
+        autoBaudEdge(isrCycle);
+        return;
+    }
     bool level = (m_isrLastCycle & 1) ^ m_invert;
 
     // error introduced by edge value in LSB of isrCycle is negligible
+    const uint32_t lastEdgeCycle = m_isrLastCycle;
     int32_t cycles = isrCycle - m_isrLastCycle;
     m_isrLastCycle = isrCycle;
 
@@ -340,10 +550,11 @@ void SoftwareSerial52::rxBits(const uint32_t & isrCycle) {
     if (cycles % m_bitCycles > (m_bitCycles >> 1)) ++bits;
     while (bits > 0) {
         // start bit detection
-        if (m_rxCurBit >= m_dataBits) {
+        if (m_rxCurBit >= m_pduBits) {
             // leading edge of start bit
             if (level) break;
             m_rxCurBit = -1;
+            m_rxCurStartCycle = lastEdgeCycle;
             --bits;
             continue;
         }
@@ -356,13 +567,37 @@ void SoftwareSerial52::rxBits(const uint32_t & isrCycle) {
             if (level) { m_rxCurByte |= (BYTE_ALL_BITS_SET << (8 - dataBits)); }
             continue;
         }
+        // parity bit
+        if (m_parityMode != SWSERIAL_PARITY_NONE && m_rxCurBit == (m_dataBits - 1)) {
+            m_rxCurParity = level;
+            ++m_rxCurBit;
+            --bits;
+            continue;
+        }
         // stop bit
-        if (m_rxCurBit == (m_dataBits - 1)) {
+        if (m_rxCurBit == (m_pduBits - 1)) {
             // Store the received value in the buffer unless we have an overflow
-            // if not high stop bit level, discard word
-            if (level)
-            {
-                m_buffer->push(m_rxCurByte >> (sizeof(uint8_t) * 8 - m_dataBits));
+            // if not high stop bit level or parity mismatch, discard word
+            uint8_t data = m_rxCurByte >> (sizeof(uint8_t) * 8 - m_dataBits);
+            if (!level) {
+                ++m_stats.framingErrors;
+                if (m_rxPendingLineErrors < 255) { ++m_rxPendingLineErrors; }
+            }
+            else if (m_parityMode != SWSERIAL_PARITY_NONE &&
+                m_rxCurParity != (parityOdd(data) ^ (m_parityMode == SWSERIAL_PARITY_ODD))) {
+                ++m_stats.parityErrors;
+                if (m_rxPendingLineErrors < 255) { ++m_rxPendingLineErrors; }
+            }
+            else if (m_buffer.push(data)) {
+                // convert the start bit cycle to millis, the cycle counter wraps too quickly
+                // to keep it around (about 53 s at 80 MHz)
+                const uint32_t age = ESP.getCycleCount() - m_rxCurStartCycle;
+                m_rxTimestamps.push(millis() - age / (ESP.getCpuFreqMHz() * 1000U));
+                m_rxLineErrors.push(m_rxPendingLineErrors);
+                m_rxPendingLineErrors = 0;
+            }
+            else {
+                m_overflow = true;
             }
             ++m_rxCurBit;
             // reset to 0 is important for masked bit logic
@@ -377,9 +612,7 @@ void ICACHE_RAM_ATTR SoftwareSerial52::rxBitISR(SoftwareSerial52 * self) {
     uint32_t curCycle = ESP.getCycleCount();
     bool level = digitalRead(self->m_rxPin);
 
-    // Store level and cycle in the buffer unless we have an overflow
-    // cycle's LSB is repurposed for the level bit
-    if (!self->m_isrBuffer->push((curCycle | 1U) ^ !level)) self->m_isrOverflow.store(true);
+    isrPushEdge(self, curCycle, level);
 }
 
 void ICACHE_RAM_ATTR SoftwareSerial52::rxBitSyncISR(SoftwareSerial52 * self) {
@@ -387,20 +620,16 @@ void ICACHE_RAM_ATTR SoftwareSerial52::rxBitSyncISR(SoftwareSerial52 * self) {
     uint32_t wait = self->m_bitCycles - 172U;
 
     bool level = self->m_invert;
-    // Store level and cycle in the buffer unless we have an overflow
-    // cycle's LSB is repurposed for the level bit
-    if (!self->m_isrBuffer->push(((start + wait) | 1U) ^ !level)) self->m_isrOverflow.store(true);
+    isrPushEdge(self, start + wait, level);
 
-    for (uint32_t i = 0; i < self->m_dataBits + 1U; ++i) {
+    for (uint32_t i = 0; i < self->m_pduBits + 1U; ++i) {
         while (ESP.getCycleCount() - start < wait) {};
         wait += self->m_bitCycles;
 
-        // Store level and cycle in the buffer unless we have an overflow
-        // cycle's LSB is repurposed for the level bit
         if (digitalRead(self->m_rxPin) != level)
         {
-            if (!self->m_isrBuffer->push(((start + wait) | 1U) ^ level)) self->m_isrOverflow.store(true);
             level = !level;
+            isrPushEdge(self, start + wait, level);
         }
     }
 }
@@ -413,7 +642,7 @@ void SoftwareSerial52::perform_work() {
     if (!m_rxValid) { return; }
     rxBits();
     if (receiveHandler) {
-        int avail = m_buffer->available();
+        int avail = m_buffer.available();
         if (avail) { receiveHandler(avail); }
     }
 }
@@ -28,18 +28,73 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 #include <Stream.h>
 #include <functional>
 
+// Capacity of the received bytes buffer. Must be a power of two.
+#ifndef SWSERIAL52_BUFFER_CAPACITY
+#define SWSERIAL52_BUFFER_CAPACITY 256
+#endif
+
+// Capacity of the ISR edge buffer. Must be a power of two. A byte takes up to
+// start, data, parity and stop bit count edges, the buffer is drained by every rxBits() call.
+#ifndef SWSERIAL52_ISR_BUFFER_CAPACITY
+#define SWSERIAL52_ISR_BUFFER_CAPACITY 2048
+#endif
+
+// Highest bitrate startAutoBaud() measures. The measurement takes every edge with the CHANGE
+// ISR, faster data is not followed reliably and aborts the measurement.
+#ifndef SWSERIAL52_AUTOBAUD_MAX_RATE
+#define SWSERIAL52_AUTOBAUD_MAX_RATE 57600
+#endif
+
+// Define to store 16-bit cycle deltas instead of 32-bit cycle counts in the ISR edge buffer,
+// halving its memory. Edges more than about 131000 cycles apart (idle line) take three entries.
+//#define SWSERIAL52_ISR_DELTA16
+
+// Bits 0-1: data bits - 5, bits 2-3: parity (see SoftwareSerial52Parity), bit 4: two stop bits.
 enum SoftwareSerial52Config {
     SWSERIAL_5N1 = 0,
     SWSERIAL_6N1,
     SWSERIAL_7N1,
     SWSERIAL_8N1,
+    SWSERIAL_5E1 = 0x04,
+    SWSERIAL_6E1,
+    SWSERIAL_7E1,
+    SWSERIAL_8E1,
+    SWSERIAL_5O1 = 0x08,
+    SWSERIAL_6O1,
+    SWSERIAL_7O1,
+    SWSERIAL_8O1,
+    SWSERIAL_5N2 = 0x10,
+    SWSERIAL_6N2,
+    SWSERIAL_7N2,
+    SWSERIAL_8N2,
+    SWSERIAL_5E2 = 0x14,
+    SWSERIAL_6E2,
+    SWSERIAL_7E2,
+    SWSERIAL_8E2,
+    SWSERIAL_5O2 = 0x18,
+    SWSERIAL_6O2,
+    SWSERIAL_7O2,
+    SWSERIAL_8O2,
+};
+
+enum SoftwareSerial52Parity {
+    SWSERIAL_PARITY_NONE = 0,
+    SWSERIAL_PARITY_EVEN,
+    SWSERIAL_PARITY_ODD,
+};
+
+/// Line level receive error counters, see SoftwareSerial52::getStats().
+struct SoftwareSerial52Stats {
+    uint32_t framingErrors = 0; // words discarded because the stop bit was not at idle level
+    uint32_t parityErrors = 0;  // words discarded because the parity bit did not match
 };
 
 /// This class is compatible with the corresponding AVR one, however,
 /// the constructor takes no arguments, for compatibility with the
 /// HardwareSerial class.
 /// Instead, the begin() function handles pin assignments and logic inversion.
-/// It also has optional input buffer capacity arguments for byte buffer and ISR bit buffer.
+/// The byte buffer and ISR bit buffer are statically sized, see SWSERIAL52_BUFFER_CAPACITY
+/// and SWSERIAL52_ISR_BUFFER_CAPACITY.
 /// Bitrates up to at least 115200 can be used.
 class SoftwareSerial52 : public Stream {
 public:
@@ -57,14 +112,25 @@ public:
     /// @param rxPin -1 or default: either no RX pin, or keeps the rxPin set in the ctor
     /// @param txPin -1 or default: either no TX pin (onewire), or keeps the txPin set in the ctor
     /// @param invert true: uses invert line level logic
-    /// @param bufCapacity the capacity for the received bytes buffer
-    /// @param isrBufCapacity 0: derived from bufCapacity. The capacity of the internal asynchronous
-    ///	       bit receive buffer, a suggested size is bufCapacity times the sum of
-    ///	       start, data, parity and stop bit count.
     void begin(uint32_t baud, SoftwareSerial52Config config = SWSERIAL_8N1,
         int8_t rxPin = -1, int8_t txPin = -1,
-        bool invert = false, int bufCapacity = 64, int isrBufCapacity = 0);
+        bool invert = false);
     uint32_t baudRate();
+    /// Change the TX/RX bitrate, keeps the data format and the received bytes.
+    void setBaudRate(uint32_t baud);
+    /// Measure the bitrate of the incoming data instead of decoding it. The shortest
+    /// interval between edges is taken as the bit period, once edges edges have been
+    /// seen, the nearest standard bitrate is configured and decoding resumes.
+    /// Anything received during the measurement is discarded. Data faster than
+    /// SWSERIAL52_AUTOBAUD_MAX_RATE ends the measurement, keeping the bitrate.
+    /// @param edges the number of RX edges to measure, a byte yields up to 10
+    void startAutoBaud(uint16_t edges = 64);
+    /// Cancel a pending auto-baud measurement, decoding resumes at the current bitrate.
+    void stopAutoBaud();
+    /// True while the auto-baud measurement of startAutoBaud() has not completed.
+    bool autoBaudPending() const { return m_autoBaudEdges > 0; }
+    /// True if the last auto-baud measurement completed and set the bitrate.
+    bool autoBaudDetected() const { return m_autoBaudDetected; }
     /// Transmit control pin.
     void setTransmitEnablePin(int8_t txEnablePin);
     /// Enable or disable interrupts during tx.
@@ -72,6 +138,11 @@ public:
 
     bool overflow();
 
+    /// Get the framing and parity error counters since begin() or the last resetStats().
+    /// Words with a line error are not put in the receive buffer.
+    SoftwareSerial52Stats getStats() const { return m_stats; }
+    void resetStats() { m_stats = SoftwareSerial52Stats(); }
+
     int available() override;
     int availableForWrite() {
         if (!m_txValid) return 0;
@@ -85,6 +156,23 @@ public:
     size_t readBytes(char* buffer, size_t size) override {
         return readBytes(reinterpret_cast<uint8_t*>(buffer), size);
     }
+    /// Zero-copy access to the received bytes. The bytes are returned in at most two
+    /// contiguous blocks, call commitRead() for the bytes consumed before peeking again.
+    /// @return the number of bytes in the block starting at data.
+    size_t peekContiguous(const uint8_t*& data);
+    /// As above, timestamps is set to the parallel block of arrival times of the bytes,
+    /// the millis() at their start bit edge as captured by the ISR.
+    size_t peekContiguous(const uint8_t*& data, const uint32_t*& timestamps);
+    /// As above, lineErrors is set to the parallel block of the number of words discarded for
+    /// framing or parity errors right before each byte (saturates at 255). A non-zero count
+    /// means that bytes are missing between the byte and the one before it.
+    size_t peekContiguous(const uint8_t*& data, const uint32_t*& timestamps, const uint8_t*& lineErrors);
+    /// Remove count bytes, obtained through peekContiguous(), from the receive buffer.
+    void commitRead(size_t count) {
+        m_buffer.commit_read(count);
+        m_rxTimestamps.commit_read(count);
+        m_rxLineErrors.commit_read(count);
+    }
     void flush() override;
     size_t write(uint8_t byte) override;
     size_t write(const uint8_t* buffer, size_t size) override;
@@ -93,7 +181,8 @@ public:
     }
     operator bool() const { return m_rxValid || m_txValid; }
 
-    /// Disable or enable interrupts on the rx pin.
+    /// Disable or enable interrupts on the rx pin. Edges captured before disabling
+    /// are decoded, unless an auto-baud measurement is pending.
     void enableRx(bool on);
     /// One wire control.
     void enableTx(bool on);
@@ -134,6 +223,22 @@ private:
 
     static void rxBitISR(SoftwareSerial52* self);
     static void rxBitSyncISR(SoftwareSerial52* self);
+    // Store the edge cycle and the level after the edge in the ISR buffer
+    static void isrPushEdge(SoftwareSerial52* self, uint32_t cycle, bool level);
+
+#ifdef SWSERIAL52_ISR_DELTA16
+    // entry: bits 15..1 the cycles since the previous edge >> ISR_DELTA_SHIFT, bit 0 the level.
+    // bits 15..1 all set: escape, the next two entries are the absolute cycle, high half first.
+    using IsrEntry = uint16_t;
+    static constexpr unsigned ISR_DELTA_SHIFT = 2;
+    static constexpr uint16_t ISR_DELTA_ESCAPE = 0x7FFF;
+#else
+    // entry: the cycle count of the edge, its LSB is repurposed for the level bit.
+    using IsrEntry = uint32_t;
+#endif
+    void rxIsrEntry(IsrEntry entry);
+    void autoBaudEdge(uint32_t isrCycle);
+    void setBitCycles(uint32_t baud);
 
     // Member variables
     bool m_oneWire;
@@ -147,19 +252,42 @@ private:
     bool m_invert;
     bool m_overflow = false;
     uint8_t m_dataBits;
+    SoftwareSerial52Parity m_parityMode;
+    uint8_t m_pduBits; // data bits plus parity bit
+    uint8_t m_stopBits;
     uint32_t m_bit_us;
     uint32_t m_bitCycles;
     uint32_t m_periodStart;
     uint32_t m_periodDuration;
     bool m_intTxEnabled;
-    std::unique_ptr<circular_queue<uint8_t> > m_buffer;
+    circular_queue<uint8_t, SWSERIAL52_BUFFER_CAPACITY> m_buffer;
+    // millis() at the start bit of each byte in m_buffer, pushed and popped in lockstep with it
+    circular_queue<uint32_t, SWSERIAL52_BUFFER_CAPACITY> m_rxTimestamps;
+    // words discarded right before each byte in m_buffer, also in lockstep with it
+    circular_queue<uint8_t, SWSERIAL52_BUFFER_CAPACITY> m_rxLineErrors;
+    // words discarded since the last byte pushed, stored with the next one
+    uint8_t m_rxPendingLineErrors = 0;
     // the ISR stores the relative bit times in the buffer. The inversion corrected level is used as sign bit (2's complement):
     // 1 = positive including 0, 0 = negative.
-    std::unique_ptr<circular_queue<uint32_t> > m_isrBuffer;
+    circular_queue<IsrEntry, SWSERIAL52_ISR_BUFFER_CAPACITY> m_isrBuffer;
     std::atomic<bool> m_isrOverflow;
     uint32_t m_isrLastCycle;
-    int8_t m_rxCurBit; // 0 - 7: data bits. -1: start bit. 8: stop bit.
+#ifdef SWSERIAL52_ISR_DELTA16
+    uint32_t m_isrEncodeCycle; // delta base of the ISR, the decoder keeps the same value in m_isrDecodeCycle
+    uint32_t m_isrDecodeCycle;
+    uint8_t m_isrEscape = 0;   // absolute cycle entries still to decode after an escape
+    bool m_isrEscapeLevel = false;
+#endif
+    int8_t m_rxCurBit; // 0 - 7: data bits. -1: start bit. m_dataBits: parity bit (if any). m_pduBits: stop bit.
     uint8_t m_rxCurByte = 0;
+    uint32_t m_rxCurStartCycle = 0;
+    bool m_rxCurParity = false;
+    SoftwareSerial52Stats m_stats;
+    uint16_t m_autoBaudEdges = 0; // edges still to measure, 0: auto-baud inactive
+    uint32_t m_autoBaudMin;       // shortest edge interval in cycles
+    uint32_t m_autoBaudSum;       // sum and count of the intervals within 1.5 times the shortest
+    uint16_t m_autoBaudCount;
+    bool m_autoBaudDetected = false;
 
     std::function<void(int available)> receiveHandler;
 };
@@ -43,9 +43,17 @@ using std::min;
     @brief	Instance class for a single-producer, single-consumer circular queue / ring buffer (FIFO).
             This implementation is lock-free between producer and consumer for the available(), peek(),
             pop(), and push() type functions.
+            If N is not 0, the queue has a fixed, power-of-two capacity of N elements in static storage,
+            otherwise the capacity is set at runtime and the buffer is allocated on the heap.
+*/
+template< typename T, size_t N = 0 >
+class circular_queue;
+
+/*!
+    @brief	Circular queue with a runtime capacity, see circular_queue<T, N>.
 */
 template< typename T >
-class circular_queue
+class circular_queue<T, 0>
 {
 public:
     /*!
@@ -198,6 +206,31 @@ public:
                 buffer.
     */
     size_t pop_n(T* buffer, size_t size);
+
+    /*!
+        @brief	Get the contiguous block of elements at the head of the queue, without removing them.
+                The available elements are split in at most two blocks at the wrap around, after
+                commit_read() of the first block, the next call returns the second one.
+        @return The number of elements in the block starting at data.
+    */
+    size_t peek_contiguous(const T*& data) const;
+
+    /*!
+        @brief	Remove count elements, that were obtained through peek_contiguous(), from the queue.
+    */
+    void commit_read(size_t count);
+
+    /*!
+        @brief	Get the contiguous block of free elements at the tail of the queue, for
+                the producer to fill in place.
+        @return The number of free elements in the block starting at data.
+    */
+    size_t reserve(T*& data);
+
+    /*!
+        @brief	Release count elements, that were filled in through reserve(), into the queue.
+    */
+    void commit_write(size_t count);
 #endif
 
     /*!
@@ -235,13 +268,13 @@ protected:
 };
 
 template< typename T >
-bool circular_queue<T>::capacity(const size_t cap)
+bool circular_queue<T, 0>::capacity(const size_t cap)
 {
     if (cap + 1 == m_bufSize) return true;
     else if (available() > cap) return false;
     std::unique_ptr<T[] > buffer(new T[cap + 1]);
-    const auto available = pop_n(buffer, cap);
-    m_buffer.reset(buffer);
+    const auto available = pop_n(buffer.get(), cap);
+    m_buffer = std::move(buffer);
     m_bufSize = cap + 1;
     std::atomic_thread_fence(std::memory_order_release);
     m_inPos.store(available, std::memory_order_relaxed);
@@ -250,11 +283,11 @@ bool circular_queue<T>::capacity(const size_t cap)
 }
 
 template< typename T >
-bool IRAM_ATTR circular_queue<T>::push()
+bool IRAM_ATTR circular_queue<T, 0>::push()
 {
     const auto inPos = m_inPos.load(std::memory_order_acquire);
     const unsigned next = (inPos + 1) % m_bufSize;
-    if (next == m_outPos.load(std::memory_order_relaxed)) {
+    if (next == m_outPos.load(std::memory_order_acquire)) {
         return false;
     }
 
@@ -265,11 +298,11 @@ bool IRAM_ATTR circular_queue<T>::push()
 }
 
 template< typename T >
-bool IRAM_ATTR circular_queue<T>::push(T&& val)
+bool IRAM_ATTR circular_queue<T, 0>::push(T&& val)
 {
     const auto inPos = m_inPos.load(std::memory_order_acquire);
     const unsigned next = (inPos + 1) % m_bufSize;
-    if (next == m_outPos.load(std::memory_order_relaxed)) {
+    if (next == m_outPos.load(std::memory_order_acquire)) {
         return false;
     }
 
@@ -285,10 +318,10 @@ bool IRAM_ATTR circular_queue<T>::push(T&& val)
 
 #if defined(ESP8266) || defined(ESP32) || !defined(ARDUINO)
 template< typename T >
-size_t circular_queue<T>::push_n(const T* buffer, size_t size)
+size_t circular_queue<T, 0>::push_n(const T* buffer, size_t size)
 {
     const auto inPos = m_inPos.load(std::memory_order_acquire);
-    const auto outPos = m_outPos.load(std::memory_order_relaxed);
+    const auto outPos = m_outPos.load(std::memory_order_acquire);
 
     size_t blockSize = (outPos > inPos) ? outPos - 1 - inPos : (outPos == 0) ? m_bufSize - 1 - inPos : m_bufSize - inPos;
     blockSize = min(size, blockSize);
@@ -312,10 +345,10 @@ size_t circular_queue<T>::push_n(const T* buffer, size_t size)
 #endif
 
 template< typename T >
-T circular_queue<T>::pop()
+T circular_queue<T, 0>::pop()
 {
     const auto outPos = m_outPos.load(std::memory_order_acquire);
-    if (m_inPos.load(std::memory_order_relaxed) == outPos) return defaultValue;
+    if (m_inPos.load(std::memory_order_acquire) == outPos) return defaultValue;
 
     std::atomic_thread_fence(std::memory_order_acquire);
 
@@ -329,7 +362,7 @@ T circular_queue<T>::pop()
 
 #if defined(ESP8266) || defined(ESP32) || !defined(ARDUINO)
 template< typename T >
-size_t circular_queue<T>::pop_n(T* buffer, size_t size) {
+size_t circular_queue<T, 0>::pop_n(T* buffer, size_t size) {
     size_t avail = size = min(size, available());
     if (!avail) return 0;
     const auto outPos = m_outPos.load(std::memory_order_acquire);
@@ -348,13 +381,47 @@ size_t circular_queue<T>::pop_n(T* buffer, size_t size) {
     m_outPos.store((outPos + size) % m_bufSize, std::memory_order_release);
     return size;
 }
+
+template< typename T >
+size_t circular_queue<T, 0>::peek_contiguous(const T*& data) const
+{
+    const auto outPos = m_outPos.load(std::memory_order_relaxed);
+    const auto inPos = m_inPos.load(std::memory_order_acquire);
+    data = m_buffer.get() + outPos;
+    return (inPos >= outPos) ? inPos - outPos : m_bufSize - outPos;
+}
+
+template< typename T >
+void circular_queue<T, 0>::commit_read(size_t count)
+{
+    const auto outPos = m_outPos.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    m_outPos.store((outPos + count) % m_bufSize, std::memory_order_release);
+}
+
+template< typename T >
+size_t circular_queue<T, 0>::reserve(T*& data)
+{
+    const auto inPos = m_inPos.load(std::memory_order_relaxed);
+    const auto outPos = m_outPos.load(std::memory_order_acquire);
+    data = m_buffer.get() + inPos;
+    return (outPos > inPos) ? outPos - 1 - inPos : (outPos == 0) ? m_bufSize - 1 - inPos : m_bufSize - inPos;
+}
+
+template< typename T >
+void circular_queue<T, 0>::commit_write(size_t count)
+{
+    const auto inPos = m_inPos.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    m_inPos.store((inPos + count) % m_bufSize, std::memory_order_release);
+}
 #endif
 
 template< typename T >
 #if defined(ESP8266) || defined(ESP32) || !defined(ARDUINO)
-void circular_queue<T>::for_each(const std::function<void(T&&)>& fun)
+void circular_queue<T, 0>::for_each(const std::function<void(T&&)>& fun)
 #else
-void circular_queue<T>::for_each(std::function<void(T&&)> fun)
+void circular_queue<T, 0>::for_each(std::function<void(T&&)> fun)
 #endif
 {
     auto outPos = m_outPos.load(std::memory_order_acquire);
@@ -371,9 +438,9 @@ void circular_queue<T>::for_each(std::function<void(T&&)> fun)
 
 template< typename T >
 #if defined(ESP8266) || defined(ESP32) || !defined(ARDUINO)
-bool circular_queue<T>::for_each_rev_requeue(const std::function<bool(T&)>& fun)
+bool circular_queue<T, 0>::for_each_rev_requeue(const std::function<bool(T&)>& fun)
 #else
-bool circular_queue<T>::for_each_rev_requeue(std::function<bool(T&)> fun)
+bool circular_queue<T, 0>::for_each_rev_requeue(std::function<bool(T&)> fun)
 #endif
 {
     auto inPos0 = circular_queue<T>::m_inPos.load(std::memory_order_acquire);
@@ -396,4 +463,244 @@ bool circular_queue<T>::for_each_rev_requeue(std::function<bool(T&)> fun)
     return true;
 }
 
+template< typename T, size_t N >
+class circular_queue
+{
+    static_assert(N > 0 && (N & (N - 1)) == 0, "circular_queue capacity N must be a power of two");
+public:
+    /*!
+        @brief	Constructs an empty queue of capacity N.
+    */
+    circular_queue()
+    {
+        m_inPos.store(0);
+        m_outPos.store(0);
+    }
+    circular_queue(const circular_queue&) = delete;
+    circular_queue& operator=(const circular_queue&) = delete;
+
+    /*!
+        @brief	Get the numer of elements the queue can hold at most.
+    */
+    constexpr size_t capacity() const
+    {
+        return N;
+    }
+
+    /*!
+        @brief	Discard all data in the queue.
+    */
+    void flush()
+    {
+        m_outPos.store(m_inPos.load());
+    }
+
+    /*!
+        @brief	Get a snapshot number of elements that can be retrieved by pop.
+    */
+    size_t available() const
+    {
+        // positions are free running, unsigned wrap around yields the distance
+        return m_inPos.load() - m_outPos.load();
+    }
+
+    /*!
+        @brief	Get the remaining free elementes for pushing.
+    */
+    size_t available_for_push() const
+    {
+        return N - available();
+    }
+
+    /*!
+        @brief	Peek at the next element pop will return without removing it from the queue.
+        @return An rvalue copy of the next element that can be popped. If the queue is empty,
+                return an rvalue copy of the element that is pending the next push.
+    */
+    T peek() const
+    {
+        const auto outPos = m_outPos.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return m_buffer[outPos & MASK];
+    }
+
+    /*!
+        @brief	Peek at the next pending input value.
+        @return A reference to the next element that can be pushed.
+    */
+    T& IRAM_ATTR pushpeek()
+    {
+        const auto inPos = m_inPos.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return m_buffer[inPos & MASK];
+    }
+
+    /*!
+        @brief	Release the next pending input value, accessible by pushpeek(), into the queue.
+        @return true if the queue accepted the value, false if the queue
+                was full.
+    */
+    bool IRAM_ATTR push()
+    {
+        const auto inPos = m_inPos.load(std::memory_order_relaxed);
+        if (inPos - m_outPos.load(std::memory_order_acquire) >= N) {
+            return false;
+        }
+        m_inPos.store(inPos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /*!
+        @brief	Move the rvalue parameter into the queue.
+        @return true if the queue accepted the value, false if the queue
+                was full.
+    */
+    bool IRAM_ATTR push(T&& val)
+    {
+        const auto inPos = m_inPos.load(std::memory_order_relaxed);
+        if (inPos - m_outPos.load(std::memory_order_acquire) >= N) {
+            return false;
+        }
+        m_buffer[inPos & MASK] = std::move(val);
+        m_inPos.store(inPos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /*!
+        @brief	Push a copy of the parameter into the queue.
+        @return true if the queue accepted the value, false if the queue
+                was full.
+    */
+    bool IRAM_ATTR push(const T& val)
+    {
+        return push(T(val));
+    }
+
+#if defined(ESP8266) || defined(ESP32) || !defined(ARDUINO)
+    /*!
+        @brief	Push copies of multiple elements from a buffer into the queue,
+                in order, beginning at buffer's head.
+        @return The number of elements actually copied into the queue, counted
+                from the buffer head.
+    */
+    size_t push_n(const T* buffer, size_t size)
+    {
+        const auto inPos = m_inPos.load(std::memory_order_relaxed);
+        size = min(size, static_cast<size_t>(N - (inPos - m_outPos.load(std::memory_order_acquire))));
+        if (!size) return 0;
+        const size_t n = min(size, static_cast<size_t>(N - (inPos & MASK)));
+        std::copy_n(buffer, n, m_buffer + (inPos & MASK));
+        std::copy_n(buffer + n, size - n, m_buffer);
+        m_inPos.store(inPos + size, std::memory_order_release);
+        return size;
+    }
+#endif
+
+    /*!
+        @brief	Pop the next available element from the queue.
+        @return An rvalue copy of the popped element, or a default
+                value of type T if the queue is empty.
+    */
+    T pop()
+    {
+        const auto outPos = m_outPos.load(std::memory_order_relaxed);
+        if (m_inPos.load(std::memory_order_acquire) == outPos) return defaultValue;
+        auto val = std::move(m_buffer[outPos & MASK]);
+        m_outPos.store(outPos + 1, std::memory_order_release);
+        return val;
+    }
+
+#if defined(ESP8266) || defined(ESP32) || !defined(ARDUINO)
+    /*!
+        @brief	Pop multiple elements in ordered sequence from the queue to a buffer.
+                If buffer is nullptr, simply discards up to size elements from the queue.
+        @return The number of elements actually popped from the queue to
+                buffer.
+    */
+    size_t pop_n(T* buffer, size_t size)
+    {
+        const auto outPos = m_outPos.load(std::memory_order_relaxed);
+        size = min(size, static_cast<size_t>(m_inPos.load(std::memory_order_acquire) - outPos));
+        if (!size) return 0;
+        if (buffer) {
+            const size_t n = min(size, static_cast<size_t>(N - (outPos & MASK)));
+            buffer = std::copy_n(std::make_move_iterator(m_buffer + (outPos & MASK)), n, buffer);
+            std::copy_n(std::make_move_iterator(m_buffer), size - n, buffer);
+        }
+        m_outPos.store(outPos + size, std::memory_order_release);
+        return size;
+    }
+#endif
+
+    /*!
+        @brief	Get the contiguous block of elements at the head of the queue, without removing them.
+                The available elements are split in at most two blocks at the wrap around, after
+                commit_read() of the first block, the next call returns the second one.
+        @return The number of elements in the block starting at data.
+    */
+    size_t peek_contiguous(const T*& data) const
+    {
+        const auto outPos = m_outPos.load(std::memory_order_relaxed);
+        const size_t avail = m_inPos.load(std::memory_order_acquire) - outPos;
+        data = m_buffer + (outPos & MASK);
+        return min(avail, static_cast<size_t>(N - (outPos & MASK)));
+    }
+
+    /*!
+        @brief	Remove count elements, that were obtained through peek_contiguous(), from the queue.
+    */
+    void commit_read(size_t count)
+    {
+        m_outPos.store(m_outPos.load(std::memory_order_relaxed) + count, std::memory_order_release);
+    }
+
+    /*!
+        @brief	Get the contiguous block of free elements at the tail of the queue, for
+                the producer to fill in place.
+        @return The number of free elements in the block starting at data.
+    */
+    size_t reserve(T*& data)
+    {
+        const auto inPos = m_inPos.load(std::memory_order_relaxed);
+        const size_t free = N - (inPos - m_outPos.load(std::memory_order_acquire));
+        data = m_buffer + (inPos & MASK);
+        return min(free, static_cast<size_t>(N - (inPos & MASK)));
+    }
+
+    /*!
+        @brief	Release count elements, that were filled in through reserve(), into the queue.
+    */
+    void commit_write(size_t count)
+    {
+        m_inPos.store(m_inPos.load(std::memory_order_relaxed) + count, std::memory_order_release);
+    }
+
+    /*!
+        @brief	Iterate over and remove each available element from queue,
+                calling back fun with an rvalue reference of every single element.
+    */
+#if defined(ESP8266) || defined(ESP32) || !defined(ARDUINO)
+    void for_each(const std::function<void(T&&)>& fun)
+#else
+    void for_each(std::function<void(T&&)> fun)
+#endif
+    {
+        auto outPos = m_outPos.load(std::memory_order_relaxed);
+        const auto inPos = m_inPos.load(std::memory_order_acquire);
+        while (outPos != inPos)
+        {
+            fun(std::move(m_buffer[outPos & MASK]));
+            ++outPos;
+            m_outPos.store(outPos, std::memory_order_release);
+        }
+    }
+
+protected:
+    static constexpr unsigned MASK = N - 1;
+    const T defaultValue = {};
+    T m_buffer[N];
+    std::atomic<unsigned> m_inPos;
+    std::atomic<unsigned> m_outPos;
+};
+
 #endif // __circular_queue_h
@@ -197,4 +197,129 @@ bool circular_queue_mp<T>::for_each_requeue(const std::function<bool(T&)>& fun)
     return true;
 }
 
+/*!
+    @brief	Instance class for a multi-producer, single-consumer circular queue / ring buffer (FIFO),
+            opt-in alternative to circular_queue_mp without a lock between the producers.
+            Producers reserve their slots by compare-and-swap on a push position, write the elements
+            and set a per slot published flag. Whoever takes the published flag at the input position
+            moves it on, so publishing completes even if the producer of an earlier slot is preempted
+            or interrupted, and the single consumer sees the elements in reservation order.
+            Meant for targets with a compare-and-swap instruction. The LX106 of the ESP8266 has none,
+            there the atomics are emulated and circular_queue_mp is the better choice.
+*/
+template< typename T >
+class circular_queue_mp_lockfree : protected circular_queue<T>
+{
+public:
+    circular_queue_mp_lockfree(const size_t capacity) :
+        circular_queue<T>(capacity), m_published(new std::atomic<bool>[capacity + 1])
+    {
+        for (unsigned i = 0; i < circular_queue<T>::m_bufSize; ++i)
+            m_published[i].store(false);
+        m_pushPos.store(circular_queue<T>::m_inPos.load());
+    }
+    using circular_queue<T>::capacity;
+    using circular_queue<T>::available;
+    using circular_queue<T>::available_for_push;
+    using circular_queue<T>::peek;
+    using circular_queue<T>::pop;
+    using circular_queue<T>::pop_n;
+
+    /*!
+        @brief	Move the rvalue parameter into the queue, lock-free for
+                multiple concurrent producers.
+        @return true if the queue accepted the value, false if the queue
+                was full.
+    */
+    bool push(T&& val)
+    {
+        unsigned pos;
+        if (!reserveSlots(pos, 1))
+            return false;
+        circular_queue<T>::m_buffer[pos] = std::move(val);
+        publishSlots(pos, 1);
+        return true;
+    }
+
+    /*!
+        @brief	Push a copy of the parameter into the queue, lock-free for
+                multiple concurrent producers.
+        @return true if the queue accepted the value, false if the queue
+                was full.
+    */
+    bool push(const T& val)
+    {
+        unsigned pos;
+        if (!reserveSlots(pos, 1))
+            return false;
+        circular_queue<T>::m_buffer[pos] = val;
+        publishSlots(pos, 1);
+        return true;
+    }
+
+    /*!
+        @brief	Push copies of multiple elements from a buffer into the queue,
+                in order, beginning at buffer's head. The slots are reserved at
+                once, push_n() is atomic.
+        @return The number of elements actually copied into the queue, counted
+                from the buffer head.
+    */
+    size_t push_n(const T* buffer, size_t size)
+    {
+        unsigned pos;
+        size = std::min(size, available_for_push());
+        while (size && !reserveSlots(pos, size))
+            size = std::min(size - 1, available_for_push());
+        if (!size)
+            return 0;
+        const auto bufSize = circular_queue<T>::m_bufSize;
+        for (size_t i = 0; i < size; ++i)
+            circular_queue<T>::m_buffer[(pos + i) % bufSize] = buffer[i];
+        publishSlots(pos, size);
+        return size;
+    }
+
+protected:
+    bool reserveSlots(unsigned& pos, size_t count)
+    {
+        const auto bufSize = circular_queue<T>::m_bufSize;
+        pos = m_pushPos.load();
+        do {
+            int avail = static_cast<int>(circular_queue<T>::m_outPos.load(std::memory_order_acquire) - pos) - 1;
+            if (avail < 0)
+                avail += bufSize;
+            if (static_cast<size_t>(avail) < count)
+                return false;
+        } while (!m_pushPos.compare_exchange_weak(pos, (pos + count) % bufSize));
+        return true;
+    }
+
+    void publishSlots(unsigned pos, size_t count)
+    {
+        const auto bufSize = circular_queue<T>::m_bufSize;
+        for (size_t i = 0; i < count; ++i)
+            m_published[(pos + i) % bufSize].store(true);
+        for (;;)
+        {
+            const auto inPos = circular_queue<T>::m_inPos.load();
+            if (!m_published[inPos].exchange(false))
+                break;
+            // the compare-and-swap overwrites its expected value on failure, the flag
+            // must go back to the slot it was taken from
+            auto expected = inPos;
+            if (circular_queue<T>::m_inPos.compare_exchange_strong(expected, (inPos + 1) % bufSize))
+                continue;
+            // inPos was stale, the flag belongs to a slot after m_inPos. Hand it back and look
+            // again: m_inPos may have reached the slot meanwhile, and the producer that moved it
+            // there stopped on the flag taken here
+            m_published[inPos].store(true);
+        }
+    }
+
+    // next free position for producers to reserve, runs ahead of m_inPos by the unpublished slots
+    std::atomic<unsigned> m_pushPos;
+    // per slot flag, set by the producer once the slot at that position is written
+    std::unique_ptr<std::atomic<bool>[]> m_published;
+};
+
 #endif // __circular_queue_mp_h
@@ -0,0 +1,30 @@
+#include "AllocationCounter.h"
+#include <cstdlib>
+#include <new>
+
+static bool counting = false;
+static size_t allocations = 0;
+
+void countAllocations(bool count) { counting = count; }
+
+size_t takeAllocations()
+{
+	size_t counted = allocations;
+	allocations = 0;
+	return counted;
+}
+
+void * operator new(size_t size)
+{
+	if (counting)
+		allocations++;
+	if (void * memory = malloc(size ? size : 1))
+		return memory;
+	throw std::bad_alloc();
+}
+
+void * operator new[](size_t size) { return operator new(size); }
+void operator delete(void * memory) noexcept { free(memory); }
+void operator delete[](void * memory) noexcept { free(memory); }
+void operator delete(void * memory, size_t) noexcept { free(memory); }
+void operator delete[](void * memory, size_t) noexcept { free(memory); }
@@ -0,0 +1,7 @@
+// Counts the operator new calls of the host tests, replacing the global operator new.
+#pragma once
+#include <cstddef>
+
+// allocations since the last call, counted while counting is on
+void countAllocations(bool count);
+size_t takeAllocations();
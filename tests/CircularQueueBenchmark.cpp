@@ -0,0 +1,89 @@
+// Push/pop throughput of circular_queue<T> (runtime capacity, heap buffer) against
+// circular_queue<T, N> (static power-of-two storage, mask indexing).
+//   CircularQueueBenchmark [operations]
+// Single-threaded: it measures the cost of the index arithmetic, as in the SoftwareSerial52 ISR
+// push and the decoder pop, not contention.
+#include "circular_queue/circular_queue.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+static const size_t Capacity = 256;
+
+template< typename Queue, typename T >
+static bool run(const char * name, Queue & queue, size_t operations)
+{
+	// checksum of the popped values, keeps the work from being optimized out and checks the order
+	uint64_t expectedSum = 0, sum = 0;
+	T next = 0, expected = 0;
+	bool ordered = true;
+
+	auto start = std::chrono::steady_clock::now();
+	// interleaved: one push, one pop with a few elements queued, like the ISR and a fast reader
+	for (size_t cnt = 0; cnt < 8; ++cnt)
+	{
+		expectedSum += next;
+		queue.push(next++);
+	}
+	for (size_t cnt = 0; cnt < operations / 2; ++cnt)
+	{
+		expectedSum += next;
+		queue.push(next++);
+		T value = queue.pop();
+		ordered &= value == expected++;
+		sum += value;
+	}
+	while (queue.available())
+	{
+		T value = queue.pop();
+		ordered &= value == expected++;
+		sum += value;
+	}
+	auto interleaved = std::chrono::steady_clock::now() - start;
+
+	start = std::chrono::steady_clock::now();
+	// bursts: fill up, then empty with available(), like a reader polling less often
+	for (size_t done = 0; done < operations; )
+	{
+		while (queue.available_for_push())
+		{
+			expectedSum += next;
+			queue.push(next++);
+			++done;
+		}
+		while (queue.available())
+		{
+			T value = queue.pop();
+			ordered &= value == expected++;
+			sum += value;
+			++done;
+		}
+	}
+	auto bursts = std::chrono::steady_clock::now() - start;
+
+	auto mops = [operations](std::chrono::steady_clock::duration time) {
+		return operations / std::chrono::duration<double, std::micro>(time).count();
+	};
+	printf("%-34s interleaved %7.1f Mops/s   bursts %7.1f Mops/s\n", name, mops(interleaved), mops(bursts));
+	return ordered && sum == expectedSum;
+}
+
+int main(int argc, char * argv[])
+{
+	size_t operations = argc > 1 ? strtoul(argv[1], nullptr, 10) : 100000000;
+	bool ok = true;
+
+	circular_queue<uint8_t> dynamicBytes(Capacity);
+	circular_queue<uint8_t, Capacity> staticBytes;
+	ok &= run<decltype(dynamicBytes), uint8_t>("circular_queue<uint8_t>(256)", dynamicBytes, operations);
+	ok &= run<decltype(staticBytes), uint8_t>("circular_queue<uint8_t, 256>", staticBytes, operations);
+
+	circular_queue<uint32_t> dynamicWords(Capacity);
+	circular_queue<uint32_t, Capacity> staticWords;
+	ok &= run<decltype(dynamicWords), uint32_t>("circular_queue<uint32_t>(256)", dynamicWords, operations);
+	ok &= run<decltype(staticWords), uint32_t>("circular_queue<uint32_t, 256>", staticWords, operations);
+
+	if (!ok)
+		printf("FAIL: values lost or out of order\n");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,150 @@
+// Multithreaded stress of circular_queue (single producer, single consumer) and circular_queue_mp
+// (1, 2, 4 and 8 producers, single consumer). Producer and consumer threads run at full speed; the
+// consumer checks that every producer's items arrive once, in order and none is lost. Reports
+// throughput and push-to-pop latency for several capacities, circular_queue_mp also against the
+// opt-in lock-free circular_queue_mp_lockfree.
+//   CircularQueueStressTest [items per run, shared by the producers]
+// Build with GOODWE_TESTS_TSAN=ON to run it under ThreadSanitizer.
+#include "circular_queue/circular_queue.h"
+#include "circular_queue/circular_queue_mp.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+struct Item
+{
+	uint32_t producer;
+	uint32_t sequence;
+	int64_t pushedNs;
+};
+
+static int64_t nowNs()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// every producer pushes its sequence, every 16th time as a push_n() of 3 items
+template< typename Queue >
+static void produce(Queue & queue, uint32_t producer, uint32_t items, const std::atomic<bool> & start)
+{
+	while (!start.load())
+		std::this_thread::yield();
+	for (uint32_t sequence = 0; sequence < items; )
+	{
+		if (sequence % 16 == 0 && items - sequence >= 3)
+		{
+			Item batch[3];
+			for (uint32_t cnt = 0; cnt < 3; ++cnt)
+				batch[cnt] = { producer, sequence + cnt, nowNs() };
+			size_t pushed = queue.push_n(batch, 3);
+			sequence += pushed;
+			if (!pushed)
+				std::this_thread::yield();
+		}
+		else if (queue.push(Item{ producer, sequence, nowNs() }))
+			++sequence;
+		else
+			std::this_thread::yield();
+	}
+}
+
+template< typename Queue >
+static bool stress(const char * name, Queue & queue, uint32_t producers, uint32_t items)
+{
+	std::atomic<bool> start(false);
+	std::vector<std::thread> threads;
+	for (uint32_t producer = 0; producer < producers; ++producer)
+		threads.emplace_back(produce<Queue>, std::ref(queue), producer, items, std::cref(start));
+
+	std::vector<uint32_t> nextSequence(producers, 0);
+	std::vector<int64_t> latencies;
+	latencies.reserve(static_cast<size_t>(producers) * items);
+	bool ok = true;
+	const uint64_t total = static_cast<uint64_t>(producers) * items;
+	auto startTime = std::chrono::steady_clock::now();
+	start.store(true);
+	for (uint64_t received = 0; received < total; )
+	{
+		if (!queue.available())
+		{
+			std::this_thread::yield();
+			continue;
+		}
+		Item item = queue.pop();
+		latencies.push_back(nowNs() - item.pushedNs);
+		if (item.producer >= producers || item.sequence != nextSequence[item.producer])
+		{
+			if (ok)
+				printf("%s: producer %u item %u, expected %u\n", name, item.producer, item.sequence,
+					item.producer < producers ? nextSequence[item.producer] : 0);
+			ok = false;
+		}
+		else
+			++nextSequence[item.producer];
+		++received;
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+	for (auto & thread : threads)
+		thread.join();
+	if (queue.available())
+	{
+		printf("%s: %zu items more than pushed\n", name, static_cast<size_t>(queue.available()));
+		ok = false;
+	}
+
+	std::sort(latencies.begin(), latencies.end());
+	auto percentile = [&latencies](double p) { return latencies[static_cast<size_t>(p * (latencies.size() - 1))] / 1000.0; };
+	printf("%-40s P=%u  %6.2f Mops/s  latency p50 %8.1f us  p99 %8.1f us  p99.9 %8.1f us  %s\n", name, producers,
+		total / seconds / 1e6, percentile(0.5), percentile(0.99), percentile(0.999), ok ? "ok" : "FAIL");
+	return ok;
+}
+
+template< size_t N >
+static bool stressSpsc(uint32_t items)
+{
+	char name[48];
+	bool ok = true;
+	{
+		circular_queue<Item> queue(N);
+		snprintf(name, sizeof(name), "circular_queue<Item>(%zu)", N);
+		ok &= stress(name, queue, 1, items);
+	}
+	{
+		circular_queue<Item, N> queue;
+		snprintf(name, sizeof(name), "circular_queue<Item, %zu>", N);
+		ok &= stress(name, queue, 1, items);
+	}
+	return ok;
+}
+
+int main(int argc, char * argv[])
+{
+	uint32_t items = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1000000;
+	bool ok = true;
+
+	ok &= stressSpsc<16>(items);
+	ok &= stressSpsc<256>(items);
+	ok &= stressSpsc<4096>(items);
+
+	for (size_t capacity : { 16, 256, 4096 })
+	{
+		for (uint32_t producers : { 1, 2, 4, 8 })
+		{
+			char name[48];
+			snprintf(name, sizeof(name), "circular_queue_mp<Item>(%zu)", capacity);
+			circular_queue_mp<Item> queue(capacity);
+			ok &= stress(name, queue, producers, items / producers);
+			snprintf(name, sizeof(name), "circular_queue_mp_lockfree<Item>(%zu)", capacity);
+			circular_queue_mp_lockfree<Item> lockFreeQueue(capacity);
+			ok &= stress(name, lockFreeQueue, producers, items / producers);
+		}
+	}
+
+	if (!ok)
+		printf("FAIL\n");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,67 @@
+#include "GoodWeCommunicatorHost.h"
+
+std::vector<GoodWeCommunicator::GoodweInverterInformation> & hostInverters()
+{
+	static std::vector<GoodWeCommunicator::GoodweInverterInformation> inverters;
+	return inverters;
+}
+
+int & hostInverterPolls()
+{
+	static int polls = 0;
+	return polls;
+}
+
+int & hostForcedDiscoveries()
+{
+	static int discoveries = 0;
+	return discoveries;
+}
+
+GoodWeCommunicator::GoodweInverterInformation & hostAddInverter(const char * serialNumber, bool isDTSeries)
+{
+	GoodWeCommunicator::GoodweInverterInformation inverter;
+	memset(inverter.serialNumber, 0, sizeof(inverter.serialNumber));
+	strncpy(inverter.serialNumber, serialNumber, sizeof(inverter.serialNumber) - 1);
+	inverter.address = 0x11 + hostInverters().size();
+	inverter.addressConfirmed = true;
+	inverter.isOnline = true;
+	inverter.isDTSeries = isDTSeries;
+	inverter.lastSeen = millis();
+	inverter.sampleTime = millis();
+	inverter.vpv1 = 312.4f;
+	inverter.ipv1 = 4.2f;
+	inverter.vac1 = 231.7f;
+	inverter.iac1 = 5.6f;
+	inverter.fac1 = 50.01f;
+	inverter.pac = 1297;
+	inverter.temp = 41.5f;
+	inverter.workMode = 1;
+	inverter.eDay = 7.25f;
+	inverter.eTotal = 10231.4f;
+	inverter.hTotal = 9876;
+	hostInverters().push_back(inverter);
+	return hostInverters().back();
+}
+
+GoodWeCommunicator::GoodWeCommunicator(SettingsManager * settingsManager) : settingsManager(settingsManager) {}
+GoodWeCommunicator::~GoodWeCommunicator() {}
+void GoodWeCommunicator::start() {}
+void GoodWeCommunicator::stop() {}
+void GoodWeCommunicator::handle() {}
+
+const std::vector<GoodWeCommunicator::GoodweInverterInformation> & GoodWeCommunicator::getInvertersInfo()
+{
+	return hostInverters();
+}
+
+bool GoodWeCommunicator::pollInverter(const char * serialNumber)
+{
+	hostInverterPolls()++;
+	return !hostInverters().empty();
+}
+
+void GoodWeCommunicator::forceDiscovery()
+{
+	hostForcedDiscoveries()++;
+}
@@ -0,0 +1,12 @@
+// GoodWeCommunicator as seen by the publishers, for their host tests: GoodWeCommunicatorHost.cpp
+// replaces GoodWeCommunicator.cpp, the tests set the inverter list directly.
+#pragma once
+#include "GoodWeCommunicator.h"
+
+std::vector<GoodWeCommunicator::GoodweInverterInformation> & hostInverters();
+// pollInverter and forceDiscovery calls
+int & hostInverterPolls();
+int & hostForcedDiscoveries();
+
+// a confirmed, online inverter with some values, sampled now
+GoodWeCommunicator::GoodweInverterInformation & hostAddInverter(const char * serialNumber, bool isDTSeries = false);
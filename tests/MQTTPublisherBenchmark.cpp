@@ -0,0 +1,139 @@
+// Cost of the MQTTPublisher publish path for 1 to 50 simulated inverters, single phase and tri
+// phase (DT), in the topic, json and binary mode. Reports per publish cycle (quick update interval,
+// every sixth one with the regular values) the messages, bytes, heap allocations and host time in
+// handle(), measured after the first cycles sized the per inverter state.
+//   MQTTPublisherBenchmark [minutes]
+// The rate limit caps a cycle at MQTT_PUBLISH_RATE messages per second, in the topic mode the
+// values of many inverters are then spread over the following cycles.
+#include "MqttBroker.h"
+#include "GoodWeCommunicatorHost.h"
+#include "MQTTPublisher.h"
+#include "AllocationCounter.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+static SettingsManager settingsManager;
+static GoodWeCommunicator goodweComms(&settingsManager);
+
+static const char * ModeNames[] = { "topic", "json", "binary" };
+
+struct CycleCost
+{
+	size_t messages = 0;
+	size_t bytes = 0;
+	size_t allocations = 0;
+	double handleUs = 0;
+	double longestCallUs = 0;
+};
+
+// handle calls every 50 ms for ms, the broker acknowledges the qos 1 messages
+static void run(MQTTPublisher & publisher, MqttBroker & broker, unsigned long ms, CycleCost & cost)
+{
+	for (unsigned long elapsed = 0; elapsed < ms; elapsed += 50)
+	{
+		takeAllocations();
+		countAllocations(true);
+		auto start = std::chrono::steady_clock::now();
+		publisher.handle();
+		double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+		countAllocations(false);
+		cost.allocations += takeAllocations();
+		cost.handleUs += us;
+		cost.longestCallUs = std::max(cost.longestCallUs, us);
+		cost.bytes += broker.client.tx.size();
+		for (auto & packet : broker.takePublished())
+		{
+			if (packet.qos())
+				broker.puback(packet.packetId);
+			cost.messages++;
+		}
+		hostAdvanceMillis(50);
+	}
+}
+
+static bool measure(int mode, size_t inverters, bool isDTSeries, unsigned long minutes)
+{
+	auto settings = settingsManager.GetSettings();
+	settings->mqttBrokers[0] = { "broker", 1883, "", "" };
+	for (int broker = 1; broker < MQTT_BROKER_COUNT; broker++)
+		settings->mqttBrokers[broker] = { "", 0, "", "" };
+	settings->mqttQuickUpdateInterval = 10000;
+	settings->mqttRegularUpdateInterval = 60000;
+	settings->mqttJsonMode = mode == 1;
+	settings->mqttBinaryMode = mode == 2;
+	settings->mqttHomeAssistantDiscovery = false;
+	settings->mqttMaxAge = 0;
+	settings->wifiHostname = "goodwe-bench";
+	hostInverters().clear();
+	hostInverters().reserve(inverters);
+	hostSetTime(1700000000);
+
+	MQTTPublisher publisher(&settingsManager, &goodweComms, 0);
+	MqttBroker broker(*hostClients().back());
+	publisher.start();
+	for (int cnt = 0; cnt < 10 && !broker.client.connected(); cnt++)
+	{
+		publisher.handle();
+		for (auto & packet : broker.take())
+		{
+			if (packet.type == 0x10)
+				broker.connack();
+		}
+		hostAdvanceMillis(10);
+	}
+	if (!broker.client.connected())
+	{
+		printf("%s: not connected\n", ModeNames[mode]);
+		return false;
+	}
+	for (size_t cnt = 0; cnt < inverters; cnt++)
+	{
+		char serialNumber[16];
+		snprintf(serialNumber, sizeof(serialNumber), "%05u%s%03u", (unsigned)(10000 + cnt % 1000), isDTSeries ? "DTN" : "SSN", (unsigned)(cnt % 1000));
+		hostAddInverter(serialNumber, isDTSeries);
+	}
+
+	//warm up, then new samples every quick update interval
+	CycleCost warmUp, cost;
+	run(publisher, broker, 2 * settings->mqttRegularUpdateInterval, warmUp);
+	unsigned long cycles = 0;
+	for (unsigned long elapsed = 0; elapsed < minutes * 60000; elapsed += settings->mqttQuickUpdateInterval)
+	{
+		for (auto & inverter : hostInverters())
+		{
+			inverter.pac += 10;
+			inverter.eDay += 0.1f;
+			inverter.sampleTime = millis();
+		}
+		run(publisher, broker, settings->mqttQuickUpdateInterval, cost);
+		cycles++;
+	}
+
+	char name[48];
+	snprintf(name, sizeof(name), "%-6s %2zu x %s", ModeNames[mode], inverters, isDTSeries ? "DT    " : "single");
+	printf("%-24s %6.1f msgs %8.0f bytes %5.1f allocs %8.1f us/cycle  longest call %7.1f us\n", name,
+		(double)cost.messages / cycles, (double)cost.bytes / cycles, (double)cost.allocations / cycles,
+		cost.handleUs / cycles, cost.longestCallUs);
+	//the steady publish path runs from preallocated buffers
+	return cost.messages > 0 && cost.allocations == 0;
+}
+
+int main(int argc, char * argv[])
+{
+	unsigned long minutes = argc > 1 ? strtoul(argv[1], nullptr, 10) : 5;
+	bool ok = true;
+
+	for (int mode = 0; mode < 3; mode++)
+	{
+		for (size_t inverters : { 1, 10, 50 })
+		{
+			ok &= measure(mode, inverters, false, minutes);
+			ok &= measure(mode, inverters, true, minutes);
+		}
+	}
+
+	if (!ok)
+		printf("FAIL: nothing published or allocations while publishing\n");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,624 @@
+// Host tests of MQTTPublisher, against the PubSubClient and WiFiClient stand-ins in stubs/. The
+// test plays the broker through MqttBroker and sets the inverters through GoodWeCommunicatorHost.
+#include "test.h"
+#include "MqttBroker.h"
+#include "GoodWeCommunicatorHost.h"
+#include "MQTTPublisher.h"
+#include "AllocationCounter.h"
+
+static SettingsManager settingsManager;
+static GoodWeCommunicator goodweComms(&settingsManager);
+
+static SettingsManager::Settings * resetSettings()
+{
+	auto settings = settingsManager.GetSettings();
+	settings->mqttBrokers[0] = { "broker", 1883, "", "" };
+	for (int broker = 1; broker < MQTT_BROKER_COUNT; broker++)
+		settings->mqttBrokers[broker] = { "", 0, "", "" };
+	settings->mqttQuickUpdateInterval = 10000;
+	settings->mqttRegularUpdateInterval = 60000;
+	settings->mqttJsonMode = false;
+	settings->mqttBinaryMode = false;
+	settings->mqttHomeAssistantDiscovery = false;
+	settings->mqttMaxAge = 0;
+	settings->wifiHostname = "goodwe-test";
+	hostInverters().clear();
+	hostClearTime();
+	hostRefuseConnections = false;
+	hostResolveFails = false;
+	return settings;
+}
+
+// handle calls until the connection is up, the broker accepts it
+static bool connect(MQTTPublisher & publisher, MqttBroker & broker)
+{
+	for (int cnt = 0; cnt < 10; cnt++)
+	{
+		publisher.handle();
+		for (auto & packet : broker.take())
+		{
+			if (packet.type == 0x10)
+				broker.connack();
+		}
+		hostAdvanceMillis(10);
+	}
+	return broker.client.connected();
+}
+
+// handle calls every stepMs for ms, the broker acknowledges the qos 1 messages. Returns what was published
+static std::vector<MqttPacket> run(MQTTPublisher & publisher, MqttBroker & broker, unsigned long ms, unsigned long stepMs = 50)
+{
+	std::vector<MqttPacket> published;
+	for (unsigned long elapsed = 0; elapsed < ms; elapsed += stepMs)
+	{
+		publisher.handle();
+		for (auto & packet : broker.takePublished())
+		{
+			if (packet.qos())
+				broker.puback(packet.packetId);
+			published.push_back(packet);
+		}
+		hostAdvanceMillis(stepMs);
+	}
+	return published;
+}
+
+// handle calls like run(), counting the allocations made by the publisher
+static size_t runCounting(MQTTPublisher & publisher, MqttBroker & broker, unsigned long ms, size_t & publishedCount)
+{
+	size_t counted = 0;
+	publishedCount = 0;
+	for (unsigned long elapsed = 0; elapsed < ms; elapsed += 50)
+	{
+		takeAllocations();
+		countAllocations(true);
+		publisher.handle();
+		countAllocations(false);
+		counted += takeAllocations();
+		for (auto & packet : broker.takePublished())
+		{
+			if (packet.qos())
+				broker.puback(packet.packetId);
+			publishedCount++;
+		}
+		hostAdvanceMillis(50);
+	}
+	return counted;
+}
+
+TEST(PublishesWithoutAllocating)
+{
+	//the publish path of every mode runs from preallocated buffers. The first cycles size the per inverter state
+	for (int mode = 0; mode < 3; mode++)
+	{
+		auto settings = resetSettings();
+		settings->mqttJsonMode = mode == 1;
+		settings->mqttBinaryMode = mode == 2;
+		settings->mqttHomeAssistantDiscovery = true;
+		hostSetTime(1700000000);
+		hostAddInverter("12345DSN678", false);
+		hostAddInverter("98765DTN432", true);
+		MQTTPublisher publisher(&settingsManager, &goodweComms, 0);
+		MqttBroker broker(*hostClients().back());
+		publisher.start();
+		CHECK(connect(publisher, broker));
+		CHECK(!run(publisher, broker, 70000).empty());
+
+		for (int cycle = 0; cycle < 3; cycle++)
+		{
+			for (auto & inverter : hostInverters())
+			{
+				inverter.pac += 100;
+				inverter.eDay += 0.5f;
+				inverter.sampleTime = millis();
+			}
+			size_t publishedCount;
+			CHECK_EQUAL(0u, runCounting(publisher, broker, 60000, publishedCount));
+			CHECK(publishedCount > 2);
+		}
+	}
+}
+
+static int countTopic(const std::vector<MqttPacket> & packets, const char * topic)
+{
+	int count = 0;
+	for (auto & packet : packets)
+		count += packet.topic == topic;
+	return count;
+}
+
+TEST(PublishesChangedValuesWithMaxAge)
+{
+	auto settings = resetSettings();
+	settings->mqttMaxAge = 300000;
+	auto & inverter = hostAddInverter("12345DSN678");
+	inverter.errorMessage = INT32_MIN;
+	MQTTPublisher publisher(&settingsManager, &goodweComms, 0);
+	MqttBroker broker(*hostClients().back());
+	publisher.start();
+	CHECK(connect(publisher, broker));
+
+	//published once, the error bits with only bit 31 set are a value like any other, unsigned
+	auto published = run(publisher, broker, 61000);
+	CHECK_EQUAL(1, countTopic(published, "goodwe/12345DSN678/errormessage"));
+	for (auto & packet : published)
+	{
+		if (packet.topic == "goodwe/12345DSN678/errormessage")
+			CHECK(packet.payload == "2147483648");
+	}
+	CHECK_EQUAL(0, countTopic(run(publisher, broker, 61000), "goodwe/12345DSN678/errormessage"));
+	//a change over the whole 32 bit range
+	hostInverters()[0].errorMessage = INT32_MAX;
+	CHECK_EQUAL(1, countTopic(run(publisher, broker, 61000), "goodwe/12345DSN678/errormessage"));
+	//unchanged values again after the max age
+	published = run(publisher, broker, 300000);
+	CHECK_EQUAL(1, countTopic(published, "goodwe/12345DSN678/errormessage"));
+	CHECK(countTopic(published, "goodwe/12345DSN678/pac") >= 1);
+}
+
+TEST(ClampsMaxAgeToThePublishTimeRange)
+{
+	//a max age beyond the 16 bit publish times still republishes, after MQTT_MAX_AGE_LIMIT
+	auto settings = resetSettings();
+	settings->mqttMaxAge = 100000000;
+	hostAddInverter("12345DSN678");
+	MQTTPublisher publisher(&settingsManager, &goodweComms, 0);
+	MqttBroker broker(*hostClients().back());
+	publisher.start();
+	CHECK(connect(publisher, broker));
+	CHECK_EQUAL(1, countTopic(run(publisher, broker, 20000), "goodwe/12345DSN678/pac"));
+	CHECK_EQUAL(0, countTopic(run(publisher, broker, (MQTT_MAX_AGE_LIMIT - 60) * 1000UL, 5000), "goodwe/12345DSN678/pac"));
+	CHECK_EQUAL(1, countTopic(run(publisher, broker, 120000, 5000), "goodwe/12345DSN678/pac"));
+}
+
+// the time of a binary sample: [array 16 header, schema version, time, ...]
+static int64_t binaryTime(const std::string & payload)
+{
+	auto bytes = reinterpret_cast<const uint8_t*>(payload.data());
+	if (bytes[4] < 0x80)
+		return bytes[4];
+	if (bytes[4] >= 0xe0)
+		return (int8_t)bytes[4];
+	int64_t time = (int32_t)(bytes[5] << 24 | bytes[6] << 16 | bytes[7] << 8 | bytes[8]);
+	return bytes[4] == 0xd2 ? time : (uint32_t)time;
+}
+
+TEST(StampsBinarySamplesWithTheSampleTime)
+{
+	auto settings = resetSettings();
+	settings->mqttBinaryMode = true;
+	hostAddInverter("12345DSN678");
+	MQTTPublisher publisher(&settingsManager, &goodweComms, 0);
+	MqttBroker broker(*hostClients().back());
+	publisher.start();
+	CHECK(connect(publisher, broker));
+	hostAdvanceMillis(20000);
+	hostSetTime(1700000000);
+
+	//received 7 seconds ago, the time is of the sample and not of the publish
+	hostInverters()[0].sampleTime = millis() - 7000;
+	auto published = run(publisher, broker, 100);
+	CHECK_EQUAL(1u, published.size());
+	if (!published.empty())
+		CHECK_EQUAL(1700000000 - 7, binaryTime(published[0].payload));
+
+	//negative age without a clock
+	hostClearTime();
+	hostInverters()[0].sampleTime = millis() - 12000;
+	hostAdvanceMillis(settings->mqttQuickUpdateInterval);
+	published = run(publisher, broker, 100);
+	CHECK_EQUAL(1u, published.size());
+	if (!published.empty())
+		CHECK_EQUAL(-12 - settings->mqttQuickUpdateInterval / 1000, binaryTime(published[0].payload));
+}
+
+TEST(ReadsPubacksSplitOverHandleCalls)
+{
+	auto settings = resetSettings();
+	hostAddInverter("12345DSN678");
+	MQTTPublisher publisher(&settingsManager, &goodweComms, 0);
+	MqttBroker broker(*hostClients().back());
+	publisher.start();
+	CHECK(connect(publisher, broker));
+
+	//the regular values go out with qos 1, the window fills up
+	hostAdvanceMillis(settings->mqttRegularUpdateInterval + 1);
+	std::vector<uint16_t> packetIds;
+	for (int cnt = 0; cnt < 20; cnt++)
+	{
+		publisher.handle();
+		for (auto & packet : broker.takePublished())
+		{
+			if (packet.qos())
+				packetIds.push_back(packet.packetId);
+		}
+		hostAdvanceMillis(50);
+	}
+	CHECK_EQUAL((size_t)MQTT_INFLIGHT_WINDOW, packetIds.size());
+
+	//the first PUBACK arrives in two parts, the others with a command between them
+	auto waited = hostPubSubWaitedMs();
+	broker.send({ 0x40, 0x02, (uint8_t)(packetIds[0] >> 8) });
+	publisher.handle();
+	CHECK_EQUAL(3u, broker.client.rx.size());
+	hostAdvanceMillis(50);
+	broker.send({ (uint8_t)packetIds[0] });
+	for (size_t cnt = 1; cnt + 1 < packetIds.size(); cnt++)
+		broker.puback(packetIds[cnt]);
+	broker.publish("goodwe/goodwe-test/cmd", "poll");
+	broker.puback(packetIds.back());
+	int polls = hostInverterPolls();
+	publisher.handle();
+	CHECK_EQUAL(polls + 1, hostInverterPolls());
+	CHECK(broker.client.rx.empty());
+	//PubSubClient never waited for the rest of the PUBACK
+	CHECK_EQUAL(waited, hostPubSubWaitedMs());
+
+	//all acknowledged: the window is free for the next regular values and nothing is sent again
+	packetIds.clear();
+	for (int cnt = 0; cnt < 200; cnt++)
+	{
+		publisher.handle();
+		for (auto & packet : broker.takePublished())
+		{
+			CHECK(!(packet.flags & 0x08));
+			if (packet.qos())
+			{
+				packetIds.push_back(packet.packetId);
+				broker.puback(packet.packetId);
+			}
+		}
+		hostAdvanceMillis(50);
+	}
+	CHECK(packetIds.size() > 4);
+}
+
+TEST(TakesCommandsFromTheFirstBrokerOnly)
+{
+	auto settings = resetSettings();
+	settings->mqttBrokers[1] = { "broker2", 1883, "", "" };
+	MQTTPublisher first(&settingsManager, &goodweComms, 0);
+	MqttBroker firstBroker(*hostClients().back());
+	MQTTPublisher second(&settingsManager, &goodweComms, 1);
+	MqttBroker secondBroker(*hostClients().back());
+	first.start();
+	second.start();
+	int subscriptions[2] = { 0, 0 };
+	for (int cnt = 0; cnt < 10; cnt++)
+	{
+		first.handle();
+		second.handle();
+		MqttBroker * brokers[] = { &firstBroker, &secondBroker };
+		for (int broker = 0; broker < 2; broker++)
+		{
+			for (auto & packet : brokers[broker]->take())
+			{
+				if (packet.type == 0x10)
+					brokers[broker]->connack();
+				if (packet.type == 0x80 && packet.topic == "goodwe/goodwe-test/cmd")
+					subscriptions[broker]++;
+			}
+		}
+		hostAdvanceMillis(10);
+	}
+	CHECK(firstBroker.client.connected() && secondBroker.client.connected());
+	CHECK_EQUAL(1, subscriptions[0]);
+	CHECK_EQUAL(0, subscriptions[1]);
+}
+
+// a connected publisher of broker 0 and its broker
+struct Connected
+{
+	Connected() : publisher(&settingsManager, &goodweComms, 0), broker(*hostClients().back())
+	{
+		publisher.start();
+		CHECK(connect(publisher, broker));
+	}
+	MQTTPublisher publisher;
+	MqttBroker broker;
+};
+
+TEST(ConnectsWithoutWaitingForTheConnack)
+{
+	resetSettings();
+	MQTTPublisher publisher(&settingsManager, &goodweComms, 0);
+	MqttBroker broker(*hostClients().back());
+	publisher.start();
+	auto waited = hostPubSubWaitedMs();
+
+	//resolve, then tcp connect and CONNECT
+	publisher.handle();
+	publisher.handle();
+	auto packets = broker.take();
+	CHECK(packets.size() == 1 && packets[0].type == 0x10);
+	//the handle calls go on while the broker has not answered
+	for (int cnt = 0; cnt < 10; cnt++)
+	{
+		publisher.handle();
+		hostAdvanceMillis(100);
+	}
+	CHECK(broker.take().empty());
+	broker.connack();
+	publisher.handle();
+	packets = broker.take();
+	CHECK(packets.size() == 2 && packets[0].topic == "goodwe" && packets[0].payload == "online" && packets[1].type == 0x80);
+	CHECK_EQUAL(waited, hostPubSubWaitedMs());
+	CHECK(broker.client.connected());
+}
+
+TEST(ClosesSessionsTheBrokerDoesNotAccept)
+{
+	resetSettings();
+	MQTTPublisher publisher(&settingsManager, &goodweComms, 0);
+	MqttBroker broker(*hostClients().back());
+	publisher.start();
+	publisher.handle();
+	publisher.handle();
+	CHECK(broker.client.connected());
+
+	//no CONNACK within MQTT_SESSION_TIMEOUT
+	for (int cnt = 0; cnt < MQTT_SESSION_TIMEOUT / 100 + 1; cnt++)
+	{
+		publisher.handle();
+		hostAdvanceMillis(100);
+	}
+	CHECK(!broker.client.connected());
+
+	//refused, bad user name or password
+	hostAdvanceMillis(RECONNECT_TIMEOUT);
+	publisher.handle();
+	publisher.handle();
+	publisher.handle();
+	CHECK_EQUAL(2, broker.client.connects);
+	broker.connack(5);
+	publisher.handle();
+	CHECK(!broker.client.connected());
+	CHECK(broker.takePublished().empty());
+}
+
+TEST(SpreadsACycleOverHandleCalls)
+{
+	//every value of every inverter once, at most MQTT_PUBLISH_BURST messages at once and MQTT_PUBLISH_RATE after that
+	auto settings = resetSettings();
+	Connected connected;
+	hostAddInverter("11111SSN111");
+	hostAddInverter("22222DTN222", true);
+	hostAddInverter("33333SSN333");
+	hostAdvanceMillis(settings->mqttRegularUpdateInterval + 1);
+	std::vector<MqttPacket> published;
+	size_t mostPerCall = 0;
+	int calls = 0;
+	for (int cnt = 0; cnt < 100; cnt++)
+	{
+		connected.publisher.handle();
+		auto packets = connected.broker.takePublished();
+		mostPerCall = max(mostPerCall, packets.size());
+		calls += !packets.empty();
+		for (auto & packet : packets)
+		{
+			if (packet.qos())
+				connected.broker.puback(packet.packetId);
+			published.push_back(packet);
+		}
+		hostAdvanceMillis(50);
+	}
+	CHECK_EQUAL(21u + 31u + 21u, published.size());
+	CHECK(mostPerCall <= MQTT_PUBLISH_BURST);
+	CHECK(calls > 5);
+	for (auto serial : { "11111SSN111", "22222DTN222", "33333SSN333" })
+	{
+		CHECK_EQUAL(1, countTopic(published, (std::string("goodwe/") + serial + "/pac").c_str()));
+		CHECK_EQUAL(1, countTopic(published, (std::string("goodwe/") + serial + "/etotal").c_str()));
+	}
+	CHECK_EQUAL(1, countTopic(published, "goodwe/22222DTN222/vac3"));
+	CHECK_EQUAL(0, countTopic(published, "goodwe/11111SSN111/vac3"));
+	CHECK_EQUAL(1, countTopic(published, "goodwe/11111SSN111/pac"));
+	for (auto & packet : published)
+	{
+		if (packet.topic == "goodwe/11111SSN111/pac")
+			CHECK(packet.payload == "1297");
+		if (packet.topic == "goodwe/11111SSN111/fac1")
+			CHECK(packet.payload == "50.01");
+		if (packet.topic == "goodwe/11111SSN111/eday")
+			CHECK(packet.payload == "7.25" && packet.qos() == 1);
+	}
+}
+
+TEST(PublishesJsonStateDocuments)
+{
+	auto settings = resetSettings();
+	settings->mqttJsonMode = true;
+	Connected connected;
+	hostAddInverter("11111SSN111");
+	hostAddInverter("22222DTN222", true);
+	hostAdvanceMillis(settings->mqttQuickUpdateInterval + 1);
+	auto published = run(connected.publisher, connected.broker, 5000);
+	CHECK_EQUAL(2u, published.size());
+	CHECK(published[0].topic == "goodwe/11111SSN111/state");
+	CHECK(published[0].payload.find("{\"online\":1,\"vpv1\":312.4,") == 0);
+	CHECK(published[0].payload.find("\"pac\":1297,") != std::string::npos);
+	CHECK(published[0].payload.find("vac2") == std::string::npos);
+	CHECK(published[0].payload.back() == '}');
+	CHECK(published[1].topic == "goodwe/22222DTN222/state");
+	CHECK(published[1].payload.find("\"vac2\":0.0,") != std::string::npos);
+}
+
+TEST(PublishesBinarySamples)
+{
+	auto settings = resetSettings();
+	settings->mqttBinaryMode = true;
+	Connected connected;
+	hostAddInverter("11111SSN111");
+	hostAdvanceMillis(settings->mqttQuickUpdateInterval + 1);
+	auto published = run(connected.publisher, connected.broker, 5000);
+	CHECK_EQUAL(1u, published.size());
+	if (published.empty())
+		return;
+	//[array 16 of 2 + 31, schema version, time, online 1, vpv1 3124 (int16), ...]
+	auto & payload = published[0].payload;
+	const uint8_t start[] = { 0xdc, 0x00, 2 + MQTT_FIELD_COUNT, MQTT_BINARY_SCHEMA_VERSION };
+	CHECK(memcmp(payload.data(), start, sizeof(start)) == 0);
+	CHECK(published[0].topic == "goodwe/11111SSN111/bin");
+	CHECK(payload.find(std::string("\x01\xd1\x0c\x34", 4)) != std::string::npos);
+	//the phase 2 and 3 values are nil
+	CHECK(payload.find(std::string("\xc0\xc0\xc0\xc0\xc0\xc0", 6)) != std::string::npos);
+}
+
+TEST(KeepsSamplesWhileTheBrokerIsDown)
+{
+	resetSettings();
+	hostSetTime(1700000000);
+	hostAddInverter("11111SSN111");
+	hostRefuseConnections = true;
+	MQTTPublisher publisher(&settingsManager, &goodweComms, 0);
+	MqttBroker broker(*hostClients().back());
+	publisher.start();
+	//a new sample every 10 seconds for a minute
+	for (int sample = 0; sample < 6; sample++)
+	{
+		hostInverters()[0].sampleTime = millis();
+		hostInverters()[0].pac = 1000 + sample;
+		run(publisher, broker, 10000, 1000);
+	}
+	hostRefuseConnections = false;
+	std::vector<MqttPacket> history;
+	for (int cnt = 0; cnt < 400 && history.size() < 6; cnt++)
+	{
+		publisher.handle();
+		for (auto & packet : broker.take())
+		{
+			if (packet.type == 0x10)
+				broker.connack();
+			if (packet.topic == "goodwe/11111SSN111/history")
+				history.push_back(packet);
+		}
+		hostAdvanceMillis(50);
+	}
+	CHECK_EQUAL(6u, history.size());
+	for (size_t sample = 0; sample < history.size(); sample++)
+	{
+		//oldest first, with the sample time
+		char expected[64];
+		snprintf(expected, sizeof(expected), "{\"ts\":%ld,", 1700000000L + 10 * (long)sample);
+		CHECK(history[sample].payload.find(expected) == 0);
+		snprintf(expected, sizeof(expected), "\"pac\":%d,", 1000 + (int)sample);
+		CHECK(history[sample].payload.find(expected) != std::string::npos);
+	}
+}
+
+TEST(AnnouncesInvertersToHomeAssistant)
+{
+	auto settings = resetSettings();
+	settings->mqttHomeAssistantDiscovery = true;
+	Connected connected;
+	hostAddInverter("11111SSN111");
+	std::vector<MqttPacket> configs;
+	for (auto & packet : run(connected.publisher, connected.broker, 5000))
+	{
+		if (packet.topic.find("homeassistant/") == 0)
+			configs.push_back(packet);
+	}
+	CHECK_EQUAL(21u, configs.size());
+	for (auto & config : configs)
+	{
+		CHECK(config.retained());
+		if (config.topic == "homeassistant/sensor/goodwe_11111SSN111_pac/config")
+			CHECK(config.payload == "{\"name\":\"GoodWe 11111SSN111 pac\",\"unique_id\":\"goodwe_11111SSN111_pac\","
+				"\"state_topic\":\"goodwe/11111SSN111/pac\",\"unit_of_measurement\":\"W\",\"device_class\":\"power\","
+				"\"state_class\":\"measurement\",\"device\":{\"identifiers\":[\"goodwe_11111SSN111\"],\"name\":\"GoodWe 11111SSN111\","
+				"\"manufacturer\":\"GoodWe\"}}");
+	}
+	CHECK_EQUAL(1, countTopic(configs, "homeassistant/binary_sensor/goodwe_11111SSN111_online/config"));
+
+	//again after a reconnect, the broker may have lost them
+	connected.broker.client.stop();
+	hostAdvanceMillis(RECONNECT_TIMEOUT);
+	int again = 0;
+	for (int cnt = 0; cnt < 100; cnt++)
+	{
+		connected.publisher.handle();
+		for (auto & packet : connected.broker.take())
+		{
+			if (packet.type == 0x10)
+				connected.broker.connack();
+			again += packet.topic.find("homeassistant/") == 0;
+		}
+		hostAdvanceMillis(50);
+	}
+	CHECK_EQUAL(21, again);
+}
+
+TEST(RetransmitsUnacknowledgedQos1Messages)
+{
+	auto settings = resetSettings();
+	settings->mqttRegularUpdateInterval = 3600000;
+	Connected connected;
+	hostAddInverter("11111SSN111");
+	hostAdvanceMillis(settings->mqttRegularUpdateInterval + 1);
+	//never acknowledged: sent, then MQTT_MAX_RETRANSMITS times again with the dup flag, then dropped
+	std::vector<MqttPacket> qos1;
+	for (int cnt = 0; cnt < 2000; cnt++)
+	{
+		connected.publisher.handle();
+		for (auto & packet : connected.broker.takePublished())
+		{
+			if (packet.qos())
+				qos1.push_back(packet);
+		}
+		hostAdvanceMillis(50);
+	}
+	//the window takes MQTT_INFLIGHT_WINDOW at a time, the rest of the regular values wait for free slots
+	CHECK_EQUAL(11u * (1 + MQTT_MAX_RETRANSMITS), qos1.size());
+	int duplicates = 0;
+	for (auto & packet : qos1)
+		duplicates += (packet.flags & 0x08) != 0;
+	CHECK_EQUAL(11 * MQTT_MAX_RETRANSMITS, duplicates);
+	CHECK_EQUAL(1 + MQTT_MAX_RETRANSMITS, countTopic(qos1, "goodwe/11111SSN111/etotal"));
+}
+
+TEST(FansOutToEveryBroker)
+{
+	auto settings = resetSettings();
+	settings->mqttJsonMode = true;
+	settings->mqttBrokers[1] = { "broker2", 1883, "", "" };
+	hostAddInverter("11111SSN111");
+	MQTTPublisher first(&settingsManager, &goodweComms, 0);
+	MqttBroker firstBroker(*hostClients().back());
+	MQTTPublisher second(&settingsManager, &goodweComms, 1);
+	MqttBroker secondBroker(*hostClients().back());
+	first.start();
+	second.start();
+	CHECK(connect(first, firstBroker));
+	CHECK(connect(second, secondBroker));
+
+	//the same document to both
+	hostAdvanceMillis(settings->mqttRegularUpdateInterval + 1);
+	first.handle();
+	second.handle();
+	auto firstPublished = firstBroker.takePublished();
+	auto secondPublished = secondBroker.takePublished();
+	CHECK(firstPublished.size() == 1 && secondPublished.size() == 1);
+	if (firstPublished.size() == 1 && secondPublished.size() == 1)
+		CHECK(firstPublished[0].topic == secondPublished[0].topic && firstPublished[0].payload == secondPublished[0].payload);
+
+	//a broker that is down does not hold up the other
+	secondBroker.client.stop();
+	hostRefuseConnections = true;
+	hostInverters()[0].pac = 2000;
+	int firstCount = 0, secondCount = 0;
+	for (int cnt = 0; cnt < 600; cnt++)
+	{
+		first.handle();
+		second.handle();
+		firstCount += firstBroker.takePublished().size();
+		secondCount += secondBroker.takePublished().size();
+		hostAdvanceMillis(50);
+	}
+	CHECK_EQUAL(2, firstCount);
+	CHECK_EQUAL(0, secondCount);
+}
+
+int main()
+{
+	return runTests();
+}
@@ -0,0 +1,93 @@
+// The broker side of a publisher's connection for the MQTTPublisher host tests: decodes the
+// packets the publisher sent and answers them.
+#pragma once
+#include "ArduinoHost.h"
+#include "WiFiClient.h"
+#include <string>
+#include <vector>
+
+struct MqttPacket
+{
+	uint8_t type;			//packet type, upper nibble of the fixed header
+	uint8_t flags;			//lower nibble: dup, qos, retain for a PUBLISH
+	std::string topic;		//PUBLISH, SUBSCRIBE
+	std::string payload;	//PUBLISH
+	uint16_t packetId;		//qos 1 PUBLISH, SUBSCRIBE
+
+	bool isPublish() const { return type == 0x30; }
+	int qos() const { return (flags >> 1) & 3; }
+	bool retained() const { return flags & 1; }
+};
+
+class MqttBroker
+{
+public:
+	MqttBroker(WiFiClient & client) : client(client) {}
+
+	// the packets sent since the last call, decoded
+	std::vector<MqttPacket> take()
+	{
+		std::vector<MqttPacket> packets;
+		size_t pos = 0;
+		while (pos < client.tx.size())
+		{
+			MqttPacket packet = { (uint8_t)(client.tx[pos] & 0xf0), (uint8_t)(client.tx[pos] & 0x0f), "", "", 0 };
+			pos++;
+			size_t remaining = 0;
+			for (int shift = 0; ; shift += 7)
+			{
+				uint8_t digit = client.tx[pos++];
+				remaining |= (size_t)(digit & 0x7f) << shift;
+				if (!(digit & 0x80))
+					break;
+			}
+			size_t end = pos + remaining;
+			if (packet.type == 0x30 || packet.type == 0x80)
+			{
+				if (packet.type == 0x80)
+				{
+					packet.packetId = client.tx[pos] << 8 | client.tx[pos + 1];
+					pos += 2;
+				}
+				size_t topicLength = client.tx[pos] << 8 | client.tx[pos + 1];
+				packet.topic.assign(client.tx.begin() + pos + 2, client.tx.begin() + pos + 2 + topicLength);
+				pos += 2 + topicLength;
+				if (packet.type == 0x30 && packet.qos())
+				{
+					packet.packetId = client.tx[pos] << 8 | client.tx[pos + 1];
+					pos += 2;
+				}
+				if (packet.type == 0x30)
+					packet.payload.assign(client.tx.begin() + pos, client.tx.begin() + end);
+			}
+			pos = end;
+			packets.push_back(packet);
+		}
+		client.tx.clear();
+		return packets;
+	}
+
+	std::vector<MqttPacket> takePublished()
+	{
+		std::vector<MqttPacket> published;
+		for (auto & packet : take())
+		{
+			if (packet.isPublish())
+				published.push_back(packet);
+		}
+		return published;
+	}
+
+	void send(std::initializer_list<uint8_t> bytes) { client.rx.insert(client.rx.end(), bytes); }
+	void connack(uint8_t returnCode = 0) { send({ 0x20, 0x02, 0x00, returnCode }); }
+	void puback(uint16_t packetId) { send({ 0x40, 0x02, (uint8_t)(packetId >> 8), (uint8_t)packetId }); }
+	void publish(const char * topic, const char * payload)
+	{
+		size_t topicLength = strlen(topic), payloadLength = strlen(payload);
+		send({ 0x30, (uint8_t)(2 + topicLength + payloadLength), (uint8_t)(topicLength >> 8), (uint8_t)topicLength });
+		client.rx.insert(client.rx.end(), topic, topic + topicLength);
+		client.rx.insert(client.rx.end(), payload, payload + payloadLength);
+	}
+
+	WiFiClient & client;
+};
@@ -0,0 +1,55 @@
+// Writes what SoftwareSerial52 decodes from a long pseudo-random edge stream to a file: every byte
+// with its timestamp and line errors, then the error counters. Built with the 32-bit and with the
+// 16-bit delta ISR buffer, the two logs must be identical.
+//   SoftwareSerial52DecodeLog <log file>
+#include "SoftwareSerial52Line.h"
+#include <cstdio>
+
+int main(int argc, char * argv[])
+{
+	if (argc < 2)
+		return 2;
+	FILE * log = fopen(argv[1], "w");
+	if (!log)
+		return 2;
+
+	std::mt19937 random(2019);
+	SoftwareSerial52 serial;
+	startSerial(serial, 9600, SWSERIAL_8E1);
+	Line line(9600, SWSERIAL_8E1, CyclesPerSecond / 9600 / 8, 7);
+	Received received;
+	const uint32_t rates[] = { 9600, 19200, 38400, 4800 };
+	for (int segment = 0; segment < 4; ++segment)
+	{
+		for (int cnt = 0; cnt < 500; ++cnt)
+		{
+			//mostly back to back, sometimes idle for milliseconds to seconds
+			unsigned gap = random() % 100;
+			if (gap < 5)
+				line.idle((1 + random() % 3000) * (CyclesPerSecond / 1000));
+			else if (gap < 10)
+				line.idle((random() % 5) * CyclesPerSecond / 1000 + random() % 200000);
+			unsigned error = random() % 50;
+			line.send(random() & 0xff, error == 0, error == 1, random() % 3);
+			if (random() % 40 == 0)
+				receive(serial, line, received);
+		}
+		//switch the rate with edges still in the ISR buffer
+		line.idle(random() % 2 ? 20 * line.bitCycles : 4 * CyclesPerSecond / 1000);
+		hostSetCycles(line.time);
+		uint32_t baud = rates[(segment + 1) % 4];
+		serial.setBaudRate(baud);
+		line.setBaudRate(baud);
+	}
+	receiveRest(serial, line, received);
+
+	for (size_t cnt = 0; cnt < received.data.size(); ++cnt)
+		fprintf(log, "%02x %u %u\n", received.data[cnt], received.timestamps[cnt], received.lineErrors[cnt]);
+	auto stats = serial.getStats();
+	fprintf(log, "bytes %zu framing errors %u parity errors %u overflow %d\n", received.data.size(),
+		stats.framingErrors, stats.parityErrors, serial.overflow());
+	fclose(log);
+	printf("%zu bytes of %zu frames, %u framing errors, %u parity errors\n", received.data.size(), line.startCycles.size(),
+		stats.framingErrors, stats.parityErrors);
+	return 0;
+}
@@ -0,0 +1,117 @@
+// Synthetic serial line for the SoftwareSerial52 host tests: frames are turned into edges on the
+// rx pin of the simulated ESP8266, with a random delay per edge like the interrupt latency.
+#pragma once
+#include "ArduinoHost.h"
+#include "SoftwareSerial52.h"
+#include <random>
+#include <vector>
+
+const int RxPin = 5;
+const int TxPin = 4;
+const uint64_t CyclesPerSecond = 80000000;
+
+inline int dataBitsOf(SoftwareSerial52Config config) { return 5 + (config & 0x03); }
+inline SoftwareSerial52Parity parityOf(SoftwareSerial52Config config) { return static_cast<SoftwareSerial52Parity>((config >> 2) & 0x03); }
+inline int stopBitsOf(SoftwareSerial52Config config) { return config & 0x10 ? 2 : 1; }
+
+inline bool parityBit(uint8_t data, SoftwareSerial52Parity parity)
+{
+	bool odd = false;
+	for (; data; data >>= 1)
+		odd ^= data & 1;
+	return odd ^ (parity == SWSERIAL_PARITY_ODD);
+}
+
+// drives the rx pin with frames. Every edge gets a random delay, like the interrupt latency on the device
+class Line
+{
+public:
+	Line(uint32_t baud, SoftwareSerial52Config config, uint32_t jitterCycles = 0, unsigned seed = 1)
+		: bitCycles(CyclesPerSecond / baud), dataBits(dataBitsOf(config)), parity(parityOf(config)),
+		stopBits(stopBitsOf(config)), jitter(jitterCycles), random(seed)
+	{
+		time = hostCycles() + 10 * bitCycles;
+	}
+
+	// a frame, optionally with a bad (first) stop bit or a flipped parity bit. Followed by gapBits of idle line
+	void send(uint8_t data, bool badStop = false, bool badParity = false, int gapBits = 2)
+	{
+		time = max(time, hostCycles() + bitCycles);
+		std::vector<int> bits{ 0 };
+		for (int bit = 0; bit < dataBits; ++bit)
+			bits.push_back((data >> bit) & 1);
+		if (parity != SWSERIAL_PARITY_NONE)
+			bits.push_back(parityBit(data & ((1 << dataBits) - 1), parity) ^ badParity);
+		for (int bit = 0; bit < stopBits; ++bit)
+			bits.push_back(!(badStop && bit == 0));
+		startCycles.push_back(time);
+		for (int level : bits)
+		{
+			if (level != this->level)
+				edge(level);
+			time += bitCycles;
+		}
+		if (!level)
+			edge(1);
+		time += gapBits * bitCycles;
+	}
+
+	void idle(uint64_t cycles) { time += cycles; }
+	void setBaudRate(uint32_t baud) { bitCycles = CyclesPerSecond / baud; }
+
+	// cycle of the start bit edge of the frames sent, before the jitter
+	std::vector<uint64_t> startCycles;
+	uint64_t time;
+	uint64_t bitCycles;
+
+private:
+	void edge(int newLevel)
+	{
+		level = newLevel;
+		hostSetPin(RxPin, level, time + (jitter ? random() % jitter : 0));
+	}
+
+	int dataBits;
+	SoftwareSerial52Parity parity;
+	int stopBits;
+	uint32_t jitter;
+	std::mt19937 random;
+	int level = 1;
+};
+
+struct Received
+{
+	std::vector<uint8_t> data;
+	std::vector<uint32_t> timestamps;
+	std::vector<uint8_t> lineErrors;
+};
+
+// read everything decoded up to the current line time, through the zero-copy interface
+inline void receive(SoftwareSerial52 & serial, Line & line, Received & received)
+{
+	hostSetCycles(max(hostCycles(), line.time));
+	const uint8_t * data;
+	const uint32_t * timestamps;
+	const uint8_t * lineErrors;
+	size_t count;
+	while ((count = serial.peekContiguous(data, timestamps, lineErrors)) > 0)
+	{
+		received.data.insert(received.data.end(), data, data + count);
+		received.timestamps.insert(received.timestamps.end(), timestamps, timestamps + count);
+		received.lineErrors.insert(received.lineErrors.end(), lineErrors, lineErrors + count);
+		serial.commitRead(count);
+	}
+}
+
+// after the last frame the stop bit is only detected once the line stayed idle long enough
+inline void receiveRest(SoftwareSerial52 & serial, Line & line, Received & received)
+{
+	line.idle(20 * line.bitCycles);
+	receive(serial, line, received);
+}
+
+inline void startSerial(SoftwareSerial52 & serial, uint32_t baud, SoftwareSerial52Config config)
+{
+	hostSetPin(RxPin, 1, hostCycles());
+	serial.begin(baud, config, RxPin, TxPin, false);
+}
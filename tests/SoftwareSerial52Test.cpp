@@ -0,0 +1,359 @@
+// Decoding of SoftwareSerial52 from synthetic edge streams: data formats, parity and framing errors,
+// two stop bits, long idle gaps (the escape of the 16-bit delta ISR buffer) and auto-baud.
+// Built twice, with the 32-bit and the 16-bit delta ISR buffer (SWSERIAL52_ISR_DELTA16).
+#include "test.h"
+#include "SoftwareSerial52Line.h"
+
+static void checkTimestamps(const Received & received, const std::vector<uint64_t> & startCycles)
+{
+	CHECK_EQUAL(startCycles.size(), received.timestamps.size());
+	for (size_t cnt = 0; cnt < received.timestamps.size() && cnt < startCycles.size(); ++cnt)
+	{
+		long long expected = startCycles[cnt] / (CyclesPerSecond / 1000);
+		CHECK(llabs((long long)received.timestamps[cnt] - expected) <= 1);
+	}
+}
+
+TEST(ReceivesAllDataFormats)
+{
+	const SoftwareSerial52Config configs[] = { SWSERIAL_5O1, SWSERIAL_7E1, SWSERIAL_8N1, SWSERIAL_8E1, SWSERIAL_8O1, SWSERIAL_8N2, SWSERIAL_7E2, SWSERIAL_8O2 };
+	for (auto config : configs)
+	{
+		SoftwareSerial52 serial;
+		startSerial(serial, 9600, config);
+		Line line(9600, config, CyclesPerSecond / 9600 / 10, config);
+		std::mt19937 random(config);
+		std::vector<uint8_t> sent;
+		Received received;
+		for (int cnt = 0; cnt < 300; ++cnt)
+		{
+			uint8_t data = (cnt * 37 + 11) & ((1 << dataBitsOf(config)) - 1);
+			line.send(data, false, false, random() % 4);
+			sent.push_back(data);
+			if (cnt % 17 == 16)
+				receive(serial, line, received);
+		}
+		receiveRest(serial, line, received);
+		CHECK(received.data == sent);
+		checkTimestamps(received, line.startCycles);
+		CHECK_EQUAL(0u, serial.getStats().framingErrors);
+		CHECK_EQUAL(0u, serial.getStats().parityErrors);
+	}
+}
+
+TEST(DiscardsWordsWithParityErrors)
+{
+	for (auto config : { SWSERIAL_8E1, SWSERIAL_8O1, SWSERIAL_7E2 })
+	{
+		SoftwareSerial52 serial;
+		startSerial(serial, 9600, config);
+		Line line(9600, config, CyclesPerSecond / 9600 / 10);
+		std::vector<uint8_t> sent;
+		uint32_t errors = 0;
+		Received received;
+		for (int cnt = 0; cnt < 200; ++cnt)
+		{
+			uint8_t data = (cnt * 53 + 7) & ((1 << dataBitsOf(config)) - 1);
+			bool badParity = cnt % 13 == 5;
+			line.send(data, false, badParity);
+			if (badParity)
+				++errors;
+			else
+				sent.push_back(data);
+			if (cnt % 20 == 19)
+				receive(serial, line, received);
+		}
+		receiveRest(serial, line, received);
+		CHECK(received.data == sent);
+		CHECK_EQUAL(errors, serial.getStats().parityErrors);
+		CHECK_EQUAL(0u, serial.getStats().framingErrors);
+	}
+}
+
+TEST(DiscardsWordsWithFramingErrors)
+{
+	for (auto config : { SWSERIAL_8N1, SWSERIAL_8N2, SWSERIAL_8E1 })
+	{
+		SoftwareSerial52 serial;
+		startSerial(serial, 9600, config);
+		Line line(9600, config, CyclesPerSecond / 9600 / 10);
+		std::vector<uint8_t> sent;
+		uint32_t errors = 0;
+		Received received;
+		for (int cnt = 0; cnt < 200; ++cnt)
+		{
+			uint8_t data = (cnt * 29 + 3) & 0xff;
+			bool badStop = cnt % 17 == 3;
+			line.send(data, badStop);
+			if (badStop)
+				++errors;
+			else
+				sent.push_back(data);
+			if (cnt % 20 == 19)
+				receive(serial, line, received);
+		}
+		receiveRest(serial, line, received);
+		CHECK(received.data == sent);
+		CHECK_EQUAL(errors, serial.getStats().framingErrors);
+		serial.resetStats();
+		CHECK_EQUAL(0u, serial.getStats().framingErrors);
+	}
+}
+
+TEST(RecordsLineErrorsWithTheNextByte)
+{
+	SoftwareSerial52 serial;
+	startSerial(serial, 9600, SWSERIAL_8E1);
+	Line line(9600, SWSERIAL_8E1, CyclesPerSecond / 9600 / 10);
+	line.send(0x01);
+	line.send(0x02, true);
+	line.send(0x03);
+	line.send(0x04, false, true);
+	line.send(0x05, true);
+	line.send(0x06);
+	line.send(0x07);
+	line.send(0x08, true);
+	line.idle(20 * line.bitCycles);
+	hostSetCycles(line.time);
+
+	//the errors are stored with the byte after them, the one at the end waits for the next byte
+	std::vector<uint8_t> data, lineErrors;
+	const uint8_t * dataBlock;
+	const uint32_t * timestamps;
+	const uint8_t * lineErrorBlock;
+	size_t count;
+	while ((count = serial.peekContiguous(dataBlock, timestamps, lineErrorBlock)) > 0)
+	{
+		data.insert(data.end(), dataBlock, dataBlock + count);
+		lineErrors.insert(lineErrors.end(), lineErrorBlock, lineErrorBlock + count);
+		serial.commitRead(count);
+	}
+	CHECK((data == std::vector<uint8_t>{ 0x01, 0x03, 0x06, 0x07 }));
+	CHECK((lineErrors == std::vector<uint8_t>{ 0, 1, 2, 0 }));
+
+	line.send(0x09);
+	line.send(0x0A);
+	line.idle(20 * line.bitCycles);
+	hostSetCycles(line.time);
+	CHECK(serial.peekContiguous(dataBlock, timestamps, lineErrorBlock) == 2);
+	CHECK(dataBlock[0] == 0x09 && lineErrorBlock[0] == 1);
+	CHECK(dataBlock[1] == 0x0A && lineErrorBlock[1] == 0);
+
+	//read() keeps the line errors in step with the bytes
+	serial.read();
+	CHECK(serial.peekContiguous(dataBlock, timestamps, lineErrorBlock) == 1);
+	CHECK(dataBlock[0] == 0x0A && lineErrorBlock[0] == 0);
+}
+
+TEST(ReceivesBackToBackFramesWithTwoStopBits)
+{
+	//no idle time between the frames, the second stop bit is all there is before the next start bit
+	for (auto config : { SWSERIAL_8N2, SWSERIAL_7E2, SWSERIAL_8O2 })
+	{
+		SoftwareSerial52 serial;
+		startSerial(serial, 19200, config);
+		Line line(19200, config, CyclesPerSecond / 19200 / 10);
+		std::vector<uint8_t> sent;
+		Received received;
+		for (int cnt = 0; cnt < 100; ++cnt)
+		{
+			uint8_t data = (cnt * 101) & ((1 << dataBitsOf(config)) - 1);
+			line.send(data, false, false, 0);
+			sent.push_back(data);
+		}
+		receiveRest(serial, line, received);
+		CHECK(received.data == sent);
+		CHECK_EQUAL(0u, serial.getStats().framingErrors);
+	}
+}
+
+TEST(ReceivesAcrossLongIdleGaps)
+{
+	//with SWSERIAL52_ISR_DELTA16 edges more than about 131000 cycles (1.6 ms) apart are stored with the escape
+	const unsigned long gapsMs[] = { 0, 1, 2, 5, 100, 3000, 40000 };
+	SoftwareSerial52 serial;
+	startSerial(serial, 9600, SWSERIAL_8N1);
+	Line line(9600, SWSERIAL_8N1, CyclesPerSecond / 9600 / 10);
+	std::vector<uint8_t> sent;
+	Received received;
+	for (int cnt = 0; cnt < 70; ++cnt)
+	{
+		line.idle(gapsMs[cnt % 7] * (CyclesPerSecond / 1000));
+		uint8_t data = 0x55 ^ cnt;
+		line.send(data);
+		sent.push_back(data);
+		if (cnt % 5 == 4)
+			receive(serial, line, received);
+	}
+	receiveRest(serial, line, received);
+	CHECK(received.data == sent);
+	checkTimestamps(received, line.startCycles);
+	CHECK_EQUAL(0u, serial.getStats().framingErrors);
+	CHECK(!serial.overflow());
+}
+
+TEST(ChangesBaudRateWithEdgesPending)
+{
+	//the edges still in the ISR buffer are decoded at the rate and delta base they were captured with
+	for (bool gap : { false, true })
+	{
+		SoftwareSerial52 serial;
+		startSerial(serial, 9600, SWSERIAL_8N1);
+		Line line(9600, SWSERIAL_8N1, CyclesPerSecond / 9600 / 10);
+		std::vector<uint8_t> sent;
+		for (int cnt = 0; cnt < 20; ++cnt)
+		{
+			line.send(0x30 + cnt);
+			sent.push_back(0x30 + cnt);
+		}
+		line.idle(gap ? 3 * CyclesPerSecond / 1000 : 20 * line.bitCycles);
+		hostSetCycles(line.time);
+		serial.setBaudRate(19200);
+		line.setBaudRate(19200);
+		for (int cnt = 0; cnt < 20; ++cnt)
+		{
+			line.send(0x60 + cnt);
+			sent.push_back(0x60 + cnt);
+		}
+		Received received;
+		receiveRest(serial, line, received);
+		CHECK(received.data == sent);
+		checkTimestamps(received, line.startCycles);
+		CHECK_EQUAL(0u, serial.getStats().framingErrors);
+	}
+}
+
+TEST(ReadsThroughTheStreamInterface)
+{
+	SoftwareSerial52 serial;
+	startSerial(serial, 9600, SWSERIAL_8N1);
+	Line line(9600, SWSERIAL_8N1);
+	const char message[] = "GoodWe";
+	for (const char * c = message; *c; ++c)
+		line.send(*c);
+	line.idle(20 * line.bitCycles);
+	hostSetCycles(line.time);
+	CHECK_EQUAL(6, serial.available());
+	CHECK_EQUAL('G', serial.peek());
+	CHECK_EQUAL('G', serial.read());
+	char buffer[8] = { 0 };
+	CHECK_EQUAL(5u, serial.readBytes(buffer, sizeof(buffer)));
+	CHECK(strcmp(buffer, "oodWe") == 0);
+	CHECK_EQUAL(-1, serial.read());
+}
+
+TEST(DetectsStandardBaudRates)
+{
+	const uint8_t response[] = { 0xAA, 0x55, 0x7F, 0x00, 0x00, 0x80, 0x10, 0x39, 0x33, 0x36, 0x30, 0x30, 0x44, 0x56, 0x41 };
+	for (uint32_t baud : { 2400u, 4800u, 9600u, 19200u, 38400u, 57600u })
+	{
+		SoftwareSerial52 serial;
+		startSerial(serial, 9600, SWSERIAL_8N1);
+		serial.startAutoBaud();
+		CHECK(serial.autoBaudPending());
+		Line line(baud, SWSERIAL_8N1, CyclesPerSecond / baud / 10);
+		for (int repeat = 0; repeat < 3 && serial.autoBaudPending(); ++repeat)
+		{
+			for (uint8_t data : response)
+				line.send(data);
+			hostSetCycles(line.time);
+			serial.available();
+		}
+		CHECK(!serial.autoBaudPending());
+		CHECK(serial.autoBaudDetected());
+		CHECK(serial.baudRate() > baud - baud / 200 && serial.baudRate() < baud + baud / 200);
+
+		//measured data is discarded, the next message is decoded at the detected rate
+		line.idle(100 * line.bitCycles);
+		hostSetCycles(line.time);
+		while (serial.read() >= 0) {}
+		Received received;
+		for (uint8_t data : response)
+			line.send(data);
+		receiveRest(serial, line, received);
+		CHECK(received.data == std::vector<uint8_t>(response, response + sizeof(response)));
+	}
+}
+
+TEST(AbortsAutoBaudAboveTheMaximumRate)
+{
+	//the CHANGE ISR of the measurement can't keep up, the rate is kept and decoding resumes in its ISR mode
+	SoftwareSerial52 serial;
+	startSerial(serial, 115200, SWSERIAL_8N1);
+	CHECK_EQUAL(FALLING, hostPinInterruptMode(RxPin));
+	serial.startAutoBaud();
+	CHECK_EQUAL(CHANGE, hostPinInterruptMode(RxPin));
+	Line line(115200, SWSERIAL_8N1, CyclesPerSecond / 115200 / 10);
+	for (uint8_t data : { 0xAA, 0x55, 0x7F, 0x00 })
+		line.send(data);
+	hostSetCycles(line.time);
+	serial.available();
+	CHECK(!serial.autoBaudPending());
+	CHECK(!serial.autoBaudDetected());
+	CHECK(serial.baudRate() > 115200 - 115200 / 200 && serial.baudRate() < 115200 + 115200 / 200);
+	CHECK_EQUAL(FALLING, hostPinInterruptMode(RxPin));
+}
+
+TEST(StopsAutoBaud)
+{
+	{
+		SoftwareSerial52 serial;
+		startSerial(serial, 115200, SWSERIAL_8N1);
+		serial.startAutoBaud();
+		serial.stopAutoBaud();
+		CHECK(!serial.autoBaudPending());
+		CHECK(!serial.autoBaudDetected());
+		CHECK_EQUAL(FALLING, hostPinInterruptMode(RxPin));
+	}
+
+	//decodes at the configured rate again
+	SoftwareSerial52 serial;
+	startSerial(serial, 9600, SWSERIAL_8N1);
+	serial.startAutoBaud();
+	serial.stopAutoBaud();
+	Line line(9600, SWSERIAL_8N1, CyclesPerSecond / 9600 / 10);
+	Received received;
+	for (uint8_t data : { 0x12, 0x34 })
+		line.send(data);
+	receiveRest(serial, line, received);
+	CHECK(received.data == std::vector<uint8_t>({ 0x12, 0x34 }));
+	CHECK_EQUAL(9600u, serial.baudRate());
+}
+
+TEST(TransmitsParityAndStopBits)
+{
+	const SoftwareSerial52Config configs[] = { SWSERIAL_8N1, SWSERIAL_8E1, SWSERIAL_8O1, SWSERIAL_8N2, SWSERIAL_7E1 };
+	for (auto config : configs)
+	{
+		SoftwareSerial52 serial;
+		startSerial(serial, 9600, config);
+		hostPinWrites().clear();
+		const uint8_t data = 0x53;
+		serial.write(data);
+
+		//rebuild the bit levels from the level changes on the tx pin
+		const uint64_t bitCycles = CyclesPerSecond / 9600;
+		std::vector<int> bits;
+		auto & writes = hostPinWrites();
+		for (size_t cnt = 0; cnt + 1 < writes.size(); ++cnt)
+		{
+			int count = (writes[cnt + 1].cycle - writes[cnt].cycle + bitCycles / 2) / bitCycles;
+			bits.insert(bits.end(), count, writes[cnt].level);
+		}
+		std::vector<int> expected{ 0 };
+		for (int bit = 0; bit < dataBitsOf(config); ++bit)
+			expected.push_back((data >> bit) & 1);
+		if (parityOf(config) != SWSERIAL_PARITY_NONE)
+			expected.push_back(parityBit(data & ((1 << dataBitsOf(config)) - 1), parityOf(config)));
+		//the last high level, the stop bits and any ones before them, has no end in the writes
+		while (!expected.empty() && expected.back() == 1)
+			expected.pop_back();
+		CHECK(bits == expected);
+		CHECK(!writes.empty() && writes.back().level == 1);
+	}
+}
+
+int main()
+{
+	return runTests();
+}
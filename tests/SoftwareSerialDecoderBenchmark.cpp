@@ -0,0 +1,225 @@
+// A/B comparison of SoftwareSerial52 with the decoders it replaced, temp/SoftwareSerialOld (edge
+// timestamps decoded in available()/read()) and temp/SoftwareSerialOriginal (busy waits in the
+// start bit interrupt). All three receive the same 8N1 edge stream: every edge gets a random delay
+// of 0 to jitter - 1 cycles, and every interrupt starts IsrEntryCycles plus 0 to latency - 1 cycles
+// after its edge. Reports per decoder the byte error rate (edit distance between the sent and the
+// read bytes), the framing errors the decoder reported (the old decoders do not check the stop
+// bit), the simulated cycles per byte spent in the interrupt (only the busy waits, the cycle
+// counter reads of the other ISRs take a few) and the host time per byte for interrupt and read.
+//   SoftwareSerialDecoderBenchmark [bytes] [baud] [jitter cycles] [latency cycles]
+// Without jitter and latency the runs cover a few of each: jitter relative to the bit time, the
+// latency on the order of the ESP8266 with WiFi activity.
+#include "ArduinoHost.h"
+#include "SoftwareSerial52.h"
+#include <Stream.h>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <random>
+#include <vector>
+extern "C" {
+#include "gpio.h"
+}
+
+// both temp/ decoders define the global ObjList and sws_isr_* for their pin interrupts, a
+// namespace each keeps them apart in one executable. Their includes are already done above
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wsign-compare"
+namespace old_decoder {
+#include "../temp/SoftwareSerialOld.cpp"
+}
+namespace original_decoder {
+#include "../temp/SoftwareSerialOriginal.cpp"
+}
+#pragma GCC diagnostic pop
+
+const int RxPin = 5;
+const int TxPin = 4;
+const uint64_t CyclesPerSecond = 80000000;
+// the core dispatches a GPIO interrupt a few us after the edge, the busy wait ISRs compensate for it
+const uint32_t IsrEntryCycles = 300;
+
+// the same 8N1 frames as edges, mostly back to back, sometimes with an idle line between them
+struct EdgeStream
+{
+	struct Edge
+	{
+		uint64_t cycle;
+		int level;
+	};
+
+	EdgeStream(size_t bytes, uint32_t baud, uint32_t jitter, unsigned seed)
+	{
+		std::mt19937 random(seed);
+		uint64_t bitCycles = CyclesPerSecond / baud;
+		uint64_t time = 10 * bitCycles;
+		int level = 1;
+		for (size_t cnt = 0; cnt < bytes; ++cnt)
+		{
+			uint8_t value = random() & 0xff;
+			data.push_back(value);
+			frameEnds.push_back(time + 10 * bitCycles);
+			for (int bit = 0; bit < 10; ++bit)
+			{
+				int newLevel = bit == 0 ? 0 : bit == 9 ? 1 : (value >> (bit - 1)) & 1;
+				if (newLevel != level)
+					edges.push_back({ time + (jitter ? random() % jitter : 0), level = newLevel });
+				time += bitCycles;
+			}
+			unsigned gap = random() % 100;
+			time += (gap < 5 ? 20 + random() % 100 : random() % 3) * bitCycles;
+		}
+		end = time + 20 * bitCycles;
+	}
+
+	std::vector<uint8_t> data;
+	std::vector<Edge> edges;
+	// cycle after the stop bit of every frame, before the jitter
+	std::vector<uint64_t> frameEnds;
+	uint64_t end;
+};
+
+struct Result
+{
+	std::vector<uint8_t> data;
+	long framingErrors = -1;
+	uint64_t interruptCycles = 0;
+	double hostNs = 0;
+};
+
+// the minimum number of bytes lost, corrupted or inserted
+static size_t editDistance(const std::vector<uint8_t> & sent, const std::vector<uint8_t> & read)
+{
+	std::vector<size_t> row(read.size() + 1), next(read.size() + 1);
+	for (size_t j = 0; j <= read.size(); ++j)
+		row[j] = j;
+	for (size_t i = 1; i <= sent.size(); ++i)
+	{
+		next[0] = i;
+		for (size_t j = 1; j <= read.size(); ++j)
+			next[j] = min(min(row[j] + 1, next[j - 1] + 1), row[j - 1] + (sent[i - 1] != read[j - 1]));
+		row.swap(next);
+	}
+	return row[read.size()];
+}
+
+// every decoder starts at the same cycle after boot, the old one breaks on a cycle counter past 2^31
+static void idleLine()
+{
+	hostSetPin(RxPin, 1, 1000);
+}
+
+// queues the stream on the rx pin and lets the sketch read every few frames, like the loop() does
+static void feed(const EdgeStream & stream, Stream & serial, uint32_t latency, Result & result)
+{
+	uint64_t base = hostCycles();
+	for (auto & edge : stream.edges)
+		hostQueuePin(RxPin, edge.level, base + edge.cycle);
+	hostSetInterruptLatency(IsrEntryCycles, latency, 3);
+	uint64_t interruptCycles = hostInterruptCycles();
+	std::chrono::steady_clock::duration hostTime{};
+	for (size_t cnt = 16; cnt < stream.frameEnds.size() + 16; cnt += 16)
+	{
+		uint64_t until = base + (cnt < stream.frameEnds.size() ? stream.frameEnds[cnt] : stream.end);
+		auto start = std::chrono::steady_clock::now();
+		hostRunPins(until);
+		while (serial.available())
+			result.data.push_back(serial.read());
+		hostTime += std::chrono::steady_clock::now() - start;
+	}
+	result.interruptCycles = hostInterruptCycles() - interruptCycles;
+	result.hostNs = std::chrono::duration<double, std::nano>(hostTime).count();
+}
+
+static Result runSoftwareSerial52(const EdgeStream & stream, uint32_t baud, uint32_t latency)
+{
+	Result result;
+	idleLine();
+	SoftwareSerial52 serial;
+	serial.begin(baud, SWSERIAL_8N1, RxPin, TxPin, false);
+	feed(stream, serial, latency, result);
+	result.framingErrors = serial.getStats().framingErrors;
+	serial.end();
+	return result;
+}
+
+static Result runSoftwareSerialOld(const EdgeStream & stream, uint32_t baud, uint32_t latency)
+{
+	Result result;
+	idleLine();
+	old_decoder::SoftwareSerialOld serial(RxPin, TxPin);
+	serial.begin(baud);
+	feed(stream, serial, latency, result);
+	return result;
+}
+
+static Result runSoftwareSerialOriginal(const EdgeStream & stream, uint32_t baud, uint32_t latency)
+{
+	Result result;
+	idleLine();
+	original_decoder::SoftwareSerialOriginal serial(RxPin, TxPin);
+	serial.begin(baud);
+	feed(stream, serial, latency, result);
+	return result;
+}
+
+static void print(const char * name, const EdgeStream & stream, const Result & result, size_t errors)
+{
+	char framing[24] = "-";
+	if (result.framingErrors >= 0)
+		snprintf(framing, sizeof(framing), "%ld", result.framingErrors);
+	printf("  %-24s %5zu read %7.3f %% byte errors %5s framing errors %7.0f isr cycles/byte %7.0f host ns/byte\n",
+		name, result.data.size(), 100.0 * errors / stream.data.size(), framing,
+		(double)result.interruptCycles / stream.data.size(), result.hostNs / stream.data.size());
+}
+
+// false if a decoder lost bytes on the clean line
+static bool compare(size_t bytes, uint32_t baud, uint32_t jitter, uint32_t latency)
+{
+	EdgeStream stream(bytes, baud, jitter, 2019);
+	printf("%u baud, %zu bytes, jitter %u cycles, latency %u + %u cycles\n", baud, bytes, jitter, IsrEntryCycles, latency);
+	struct Decoder
+	{
+		const char * name;
+		Result (*run)(const EdgeStream &, uint32_t, uint32_t);
+	};
+	const Decoder decoders[] = {
+		{ "SoftwareSerial52", runSoftwareSerial52 },
+		{ "SoftwareSerialOld", runSoftwareSerialOld },
+		{ "SoftwareSerialOriginal", runSoftwareSerialOriginal },
+	};
+	bool ok = true;
+	for (auto & decoder : decoders)
+	{
+		auto result = decoder.run(stream, baud, latency);
+		size_t errors = editDistance(stream.data, result.data);
+		print(decoder.name, stream, result, errors);
+		if (!jitter && !latency && errors)
+			ok = false;
+	}
+	return ok;
+}
+
+int main(int argc, char * argv[])
+{
+	size_t bytes = argc > 1 ? strtoul(argv[1], nullptr, 10) : 2000;
+	uint32_t baud = argc > 2 ? strtoul(argv[2], nullptr, 10) : 9600;
+	uint32_t bitCycles = CyclesPerSecond / baud;
+	bool ok = true;
+
+	if (argc > 3)
+		ok &= compare(bytes, baud, strtoul(argv[3], nullptr, 10), argc > 4 ? strtoul(argv[4], nullptr, 10) : 0);
+	else
+	{
+		//up to 5 us and 50 us more latency
+		for (uint32_t jitter : { 0U, bitCycles / 8, bitCycles / 4 })
+		{
+			for (uint32_t latency : { 0U, 400U, 4000U })
+				ok &= compare(bytes, baud, jitter, latency);
+		}
+	}
+
+	if (!ok)
+		printf("FAIL: bytes lost without jitter and latency\n");
+	return ok ? 0 : 1;
+}
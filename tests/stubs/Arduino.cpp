@@ -0,0 +1,193 @@
+#include "ArduinoHost.h"
+#include "gpio.h"
+#include <cstdlib>
+#include <deque>
+#include <random>
+
+EspClass ESP;
+HardwareSerial Serial;
+
+static uint64_t cycles = 1000;
+static const uint64_t CyclesPerMs = 80000;
+
+struct HostPin
+{
+	int level = HIGH;
+	void (*isr)(void*) = nullptr;
+	void (*isrNoArg)() = nullptr;
+	void * arg = nullptr;
+	int mode = 0;
+
+	bool attached() const { return isr || isrNoArg; }
+	bool fires(int newLevel) const
+	{
+		return attached() && (mode == CHANGE || (mode == RISING && newLevel) || (mode == FALLING && !newLevel));
+	}
+	void interrupt()
+	{
+		if (isrNoArg)
+			isrNoArg();
+		else
+			isr(arg);
+	}
+};
+static HostPin pins[17];
+static std::vector<HostPinWrite> pinWrites;
+
+struct HostEdge
+{
+	uint64_t cycle;
+	int pin;
+	int level;
+};
+static std::deque<HostEdge> queuedEdges;
+static uint32_t interruptStatus = 0;
+static uint64_t interruptRaised = 0;
+static uint32_t minLatency = 0;
+static uint32_t randomLatency = 0;
+static std::mt19937 latencyRandom;
+static uint64_t interruptCycles = 0;
+
+uint64_t hostCycles() { return cycles; }
+void hostSetCycles(uint64_t value) { cycles = value; }
+void hostAdvanceMillis(unsigned long ms) { cycles += ms * CyclesPerMs; }
+std::vector<HostPinWrite> & hostPinWrites() { return pinWrites; }
+
+void hostSetPin(int pin, int level, uint64_t atCycle)
+{
+	cycles = atCycle;
+	auto & hostPin = pins[pin];
+	bool edge = hostPin.level != level;
+	hostPin.level = level;
+	if (edge && hostPin.fires(level))
+		hostPin.interrupt();
+}
+
+void hostQueuePin(int pin, int level, uint64_t atCycle)
+{
+	auto pos = std::upper_bound(queuedEdges.begin(), queuedEdges.end(), atCycle,
+		[](uint64_t cycle, const HostEdge & edge) { return cycle < edge.cycle; });
+	queuedEdges.insert(pos, { atCycle, pin, level });
+}
+
+//the queued edges up to now change the levels and latch their interrupts
+static void applyQueuedEdges()
+{
+	while (!queuedEdges.empty() && queuedEdges.front().cycle <= cycles)
+	{
+		auto edge = queuedEdges.front();
+		queuedEdges.pop_front();
+		auto & hostPin = pins[edge.pin];
+		bool changed = hostPin.level != edge.level;
+		hostPin.level = edge.level;
+		if (!changed || !hostPin.fires(edge.level))
+			continue;
+		if (!interruptStatus)
+			interruptRaised = edge.cycle;
+		interruptStatus |= 1 << edge.pin;
+	}
+}
+
+void hostRunPins(uint64_t untilCycle)
+{
+	for (;;)
+	{
+		applyQueuedEdges();
+		if (interruptStatus)
+		{
+			cycles = max(cycles, interruptRaised + minLatency + (randomLatency ? latencyRandom() % randomLatency : 0));
+			applyQueuedEdges();
+			//the core clears the status before it calls the handlers, edges meanwhile latch again. A
+			//RISING or FALLING handler only runs if the pin is still at that level
+			uint32_t status = interruptStatus;
+			interruptStatus = 0;
+			auto start = cycles;
+			for (int pin = 0; pin < 17; pin++)
+			{
+				if (status & (1 << pin) && pins[pin].fires(pins[pin].level))
+					pins[pin].interrupt();
+			}
+			interruptCycles += cycles - start;
+			continue;
+		}
+		if (queuedEdges.empty() || queuedEdges.front().cycle > untilCycle)
+			break;
+		cycles = max(cycles, queuedEdges.front().cycle);
+	}
+	cycles = max(cycles, untilCycle);
+}
+
+void hostSetInterruptLatency(uint32_t minCycles, uint32_t randomCycles, unsigned seed)
+{
+	minLatency = minCycles;
+	randomLatency = randomCycles;
+	latencyRandom.seed(seed);
+}
+
+uint64_t hostInterruptCycles() { return interruptCycles; }
+
+void hostGpioRegWrite(uint32_t address, uint32_t value)
+{
+	if (address != GPIO_STATUS_W1TC_ADDRESS)
+		return;
+	applyQueuedEdges();
+	interruptStatus &= ~value;
+}
+
+int hostPinInterruptMode(int pin) { return pins[pin].attached() ? pins[pin].mode : 0; }
+
+uint32_t EspClass::getCycleCount()
+{
+	auto value = cycles;
+	cycles += 4;
+	return static_cast<uint32_t>(value);
+}
+
+unsigned long millis() { return cycles / CyclesPerMs; }
+unsigned long micros() { return cycles / (CyclesPerMs / 1000); }
+void delay(unsigned long ms) { hostAdvanceMillis(ms); }
+void delayMicroseconds(unsigned int us) { cycles += us * (CyclesPerMs / 1000); }
+void yield() {}
+void optimistic_yield(uint32_t) {}
+long random(long howbig) { return howbig > 0 ? rand() % howbig : 0; }
+void randomSeed(unsigned long seed) { srand(seed); }
+
+void pinMode(int, int) {}
+void digitalWrite(int pin, int level) { pinWrites.push_back({ pin, level, cycles }); }
+int digitalRead(int pin)
+{
+	applyQueuedEdges();
+	return pins[pin].level;
+}
+int digitalPinToInterrupt(int pin) { return pin; }
+
+void attachInterrupt(int interrupt, void (*isr)(), int mode)
+{
+	pins[interrupt].isr = nullptr;
+	pins[interrupt].isrNoArg = isr;
+	pins[interrupt].mode = mode;
+}
+
+void attachInterruptArg(int interrupt, void (*isr)(void*), void * arg, int mode)
+{
+	pins[interrupt].isr = isr;
+	pins[interrupt].isrNoArg = nullptr;
+	pins[interrupt].arg = arg;
+	pins[interrupt].mode = mode;
+}
+
+void detachInterrupt(int interrupt)
+{
+	pins[interrupt].isr = nullptr;
+	pins[interrupt].isrNoArg = nullptr;
+}
+uint32_t xt_rsil(int) { return 0; }
+void xt_wsr_ps(uint32_t) {}
+
+size_t HardwareSerial::write(uint8_t c)
+{
+	static const bool verbose = getenv("GOODWE_TEST_VERBOSE") != nullptr;
+	if (verbose)
+		putchar(c);
+	return 1;
+}
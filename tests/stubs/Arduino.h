@@ -0,0 +1,209 @@
+// Host stand-in for the parts of the ESP8266 Arduino core the sketch uses. The clock, the
+// cycle counter and the pins are simulated, tests drive them through ArduinoHost.h.
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <cstdarg>
+#include <cmath>
+#include <string>
+#include <functional>
+#include <memory>
+#include <atomic>
+#include <algorithm>
+
+using std::min;
+using std::max;
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define ICACHE_RAM_ATTR
+#define IRAM_ATTR
+
+#define HEX 16
+#define DEC 10
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define CHANGE 3
+#define RISING 4
+#define FALLING 5
+#define D1 5
+#define D2 4
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+void optimistic_yield(uint32_t interval_us);
+long random(long howbig);
+void randomSeed(unsigned long seed);
+
+void pinMode(int pin, int mode);
+void digitalWrite(int pin, int level);
+int digitalRead(int pin);
+int digitalPinToInterrupt(int pin);
+void attachInterrupt(int interrupt, void (*isr)(), int mode);
+void attachInterruptArg(int interrupt, void (*isr)(void*), void* arg, int mode);
+void detachInterrupt(int interrupt);
+uint32_t xt_rsil(int level);
+void xt_wsr_ps(uint32_t state);
+#define interrupts() xt_rsil(0)
+#define noInterrupts() xt_rsil(15)
+#define cli() noInterrupts()
+#define sei() interrupts()
+
+class EspClass
+{
+public:
+	uint32_t getCycleCount();
+	uint32_t getCpuFreqMHz() { return 80; }
+	uint32_t getFreeHeap() { return 40000; }
+	void restart() {}
+};
+extern EspClass ESP;
+
+class String
+{
+public:
+	String() {}
+	String(const char * text) : s(text ? text : "") {}
+	String(const std::string & text) : s(text) {}
+	explicit String(char c) : s(1, c) {}
+	explicit String(int value, unsigned char base = DEC) : String((long)value, base) {}
+	explicit String(unsigned int value, unsigned char base = DEC) : String((unsigned long)value, base) {}
+	explicit String(long value, unsigned char base = DEC)
+	{
+		char buffer[24];
+		snprintf(buffer, sizeof(buffer), base == HEX ? "%lx" : "%ld", value);
+		s = buffer;
+	}
+	explicit String(unsigned long value, unsigned char base = DEC)
+	{
+		char buffer[24];
+		snprintf(buffer, sizeof(buffer), base == HEX ? "%lx" : "%lu", value);
+		s = buffer;
+	}
+	explicit String(float value, unsigned char decimals = 2) : String((double)value, decimals) {}
+	explicit String(double value, unsigned char decimals = 2)
+	{
+		char buffer[48];
+		snprintf(buffer, sizeof(buffer), "%.*f", decimals, value);
+		s = buffer;
+	}
+
+	const char * c_str() const { return s.c_str(); }
+	unsigned int length() const { return s.size(); }
+	bool reserve(unsigned int size) { s.reserve(size); return true; }
+	char operator[](unsigned int index) const { return index < s.size() ? s[index] : 0; }
+
+	String & operator+=(const String & other) { s += other.s; return *this; }
+	String & operator+=(const char * other) { s += other; return *this; }
+	String & operator+=(char other) { s += other; return *this; }
+	friend String operator+(const String & a, const String & b) { return String(a.s + b.s); }
+	friend String operator+(const String & a, const char * b) { return String(a.s + b); }
+	friend String operator+(const char * a, const String & b) { return String(a + b.s); }
+
+	bool operator==(const String & other) const { return s == other.s; }
+	bool operator==(const char * other) const { return s == other; }
+	bool operator!=(const String & other) const { return s != other.s; }
+	bool operator!=(const char * other) const { return s != other; }
+
+	int indexOf(char c, unsigned int from = 0) const
+	{
+		auto pos = s.find(c, from);
+		return pos == std::string::npos ? -1 : (int)pos;
+	}
+	String substring(unsigned int from) const { return from < s.size() ? String(s.substr(from)) : String(); }
+	String substring(unsigned int from, unsigned int to) const { return from < s.size() && from < to ? String(s.substr(from, to - from)) : String(); }
+	void trim()
+	{
+		auto first = s.find_first_not_of(" \t\r\n");
+		auto last = s.find_last_not_of(" \t\r\n");
+		s = first == std::string::npos ? "" : s.substr(first, last - first + 1);
+	}
+	int toInt() const { return atoi(s.c_str()); }
+
+private:
+	std::string s;
+};
+
+class Print
+{
+public:
+	virtual ~Print() {}
+	virtual size_t write(uint8_t c) = 0;
+	virtual size_t write(const uint8_t * buffer, size_t size)
+	{
+		size_t written = 0;
+		while (size--)
+			written += write(*buffer++);
+		return written;
+	}
+	size_t write(const char * text) { return write(reinterpret_cast<const uint8_t*>(text), strlen(text)); }
+
+	size_t print(const String & value) { return write(value.c_str()); }
+	size_t print(const char * value) { return write(value); }
+	size_t print(char value) { return write((uint8_t)value); }
+	size_t print(int value, int base = DEC) { return print(String(value, base)); }
+	size_t print(unsigned int value, int base = DEC) { return print(String(value, base)); }
+	size_t print(long value, int base = DEC) { return print(String(value, base)); }
+	size_t print(unsigned long value, int base = DEC) { return print(String(value, base)); }
+	size_t print(double value, int decimals = 2) { return print(String(value, decimals)); }
+	template<typename T> size_t println(const T & value) { return print(value) + println(); }
+	template<typename T> size_t println(const T & value, int format) { return print(value, format) + println(); }
+	size_t println() { return write("\r\n"); }
+	size_t printf(const char * format, ...)
+	{
+		char buffer[256];
+		va_list args;
+		va_start(args, format);
+		vsnprintf(buffer, sizeof(buffer), format, args);
+		va_end(args);
+		return write(buffer);
+	}
+};
+
+class Stream : public Print
+{
+public:
+	virtual int available() = 0;
+	virtual int read() = 0;
+	virtual int peek() = 0;
+	virtual void flush() {}
+	virtual size_t readBytes(char * buffer, size_t size) { return readBytes(reinterpret_cast<uint8_t*>(buffer), size); }
+	virtual size_t readBytes(uint8_t * buffer, size_t size)
+	{
+		size_t count = 0;
+		int c;
+		while (count < size && (c = read()) >= 0)
+			buffer[count++] = c;
+		return count;
+	}
+};
+
+// debug output, discarded unless GOODWE_TEST_VERBOSE is set in the environment
+class HardwareSerial : public Stream
+{
+public:
+	void begin(unsigned long baud) {}
+	int available() override { return 0; }
+	int read() override { return -1; }
+	int peek() override { return -1; }
+	size_t write(uint8_t c) override;
+	using Print::write;
+};
+extern HardwareSerial Serial;
+
+inline char * dtostrf(double value, signed char width, unsigned char decimals, char * buffer)
+{
+	sprintf(buffer, "%*.*f", width, decimals, value);
+	return buffer;
+}
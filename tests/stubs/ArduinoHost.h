@@ -0,0 +1,35 @@
+// Test control of the simulated ESP8266 in Arduino.h: a 80 MHz cycle counter that millis() and
+// micros() are derived from, and pins whose level changes fire the attached interrupt.
+#pragma once
+#include "Arduino.h"
+#include <vector>
+
+// cycles since boot. Every ESP.getCycleCount() call takes a few cycles, so busy waits end
+uint64_t hostCycles();
+void hostSetCycles(uint64_t cycles);
+void hostAdvanceMillis(unsigned long ms);
+
+// set the input level of a pin at a cycle, calls the interrupt attached to it when the edge matches its mode
+void hostSetPin(int pin, int level, uint64_t atCycle);
+// edges queued ahead for hostRunPins(), digitalRead() sees them once their cycle passed. Unlike
+// hostSetPin() the interrupt is not called at the edge: like the GPIO status register the pin
+// latches it, and it runs after the interrupt latency or when the running interrupt returned
+void hostQueuePin(int pin, int level, uint64_t atCycle);
+// run the queued edges and their interrupts up to a cycle
+void hostRunPins(uint64_t untilCycle);
+// every interrupt of a queued edge starts minCycles plus a random 0 to randomCycles - 1 cycles late
+void hostSetInterruptLatency(uint32_t minCycles, uint32_t randomCycles, unsigned seed = 1);
+// cycles spent in the interrupts of queued edges since boot, mostly busy waits on the cycle counter
+uint64_t hostInterruptCycles();
+
+// mode (CHANGE, RISING, FALLING) of the interrupt attached to a pin, 0 if none is attached
+int hostPinInterruptMode(int pin);
+
+// levels written to the pins with digitalWrite, with the cycle they were written at
+struct HostPinWrite
+{
+	int pin;
+	int level;
+	uint64_t cycle;
+};
+std::vector<HostPinWrite> & hostPinWrites();
@@ -0,0 +1,24 @@
+#pragma once
+#include "Arduino.h"
+
+class IPAddress
+{
+public:
+	IPAddress() {}
+	IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : address((uint32_t)a | b << 8 | c << 16 | (uint32_t)d << 24) {}
+	bool operator==(const IPAddress & other) const { return address == other.address; }
+	uint8_t operator[](int index) const { return address >> (index * 8); }
+
+private:
+	uint32_t address = 0;
+};
+
+class Client : public Stream
+{
+public:
+	virtual int connect(IPAddress ip, uint16_t port) = 0;
+	virtual int connect(const char * host, uint16_t port) = 0;
+	virtual uint8_t connected() = 0;
+	virtual void stop() = 0;
+	using Print::write;
+};
@@ -0,0 +1,31 @@
+#include "ESP8266WiFi.h"
+#include "TimeLib.h"
+#include "RemoteDebug.h"
+
+ESP8266WiFiClass WiFi;
+bool hostResolveFails = false;
+RemoteDebug Debug;
+
+int ESP8266WiFiClass::hostByName(const char * hostName, IPAddress & result, uint32_t timeoutMs)
+{
+	if (hostResolveFails)
+		return 0;
+	result = IPAddress(192, 168, 1, 1);
+	return 1;
+}
+
+static bool timeIsSet = false;
+static time_t timeBase = 0;
+static unsigned long timeBaseMillis = 0;
+
+time_t now() { return timeIsSet ? timeBase + (millis() - timeBaseMillis) / 1000 : millis() / 1000; }
+timeStatus_t timeStatus() { return timeIsSet ? timeSet : timeNotSet; }
+
+void hostSetTime(time_t time)
+{
+	timeIsSet = true;
+	timeBase = time;
+	timeBaseMillis = millis();
+}
+
+void hostClearTime() { timeIsSet = false; }
@@ -0,0 +1,12 @@
+#pragma once
+#include "Arduino.h"
+#include "WiFiClient.h"
+
+class ESP8266WiFiClass
+{
+public:
+	// host names resolve to 192.168.1.1, unless hostResolveFails is set
+	int hostByName(const char * hostName, IPAddress & result, uint32_t timeoutMs);
+};
+extern ESP8266WiFiClass WiFi;
+extern bool hostResolveFails;
@@ -0,0 +1,200 @@
+#include "PubSubClient.h"
+#include "ArduinoHost.h"
+
+static unsigned long waitedMs = 0;
+
+unsigned long hostPubSubWaitedMs() { return waitedMs; }
+
+bool PubSubClient::connect(const char * id, const char * user, const char * pass)
+{
+	if (connected())
+		return true;
+	if (!_client->connected())
+	{
+		_state = MQTT_CONNECT_FAILED;
+		return false;
+	}
+
+	//protocol MQTT level 4, clean session, user name and password flags
+	size_t remaining = 10 + 2 + strlen(id) + (user ? 2 + strlen(user) : 0) + (pass ? 2 + strlen(pass) : 0);
+	writeHeader(MQTTCONNECT, remaining);
+	const uint8_t variableHeader[] = { 0x00, 0x04, 'M', 'Q', 'T', 'T', 0x04,
+		(uint8_t)(0x02 | (user ? 0x80 : 0) | (pass ? 0x40 : 0)), 0x00, MQTT_KEEPALIVE };
+	_client->write(variableHeader, sizeof(variableHeader));
+	writeString(id);
+	if (user)
+		writeString(user);
+	if (pass)
+		writeString(pass);
+
+	//busy waits for the CONNACK
+	unsigned long start = millis();
+	while (!_client->available())
+	{
+		if (millis() - start >= socketTimeout * 1000UL)
+		{
+			_state = MQTT_CONNECTION_TIMEOUT;
+			_client->stop();
+			return false;
+		}
+		hostAdvanceMillis(1);
+		waitedMs++;
+	}
+	if (readPacket() == 4 && buffer[0] == 0x20)
+	{
+		if (buffer[3] == 0)
+		{
+			_state = MQTT_CONNECTED;
+			return true;
+		}
+		_state = buffer[3];
+	}
+	_client->stop();
+	return false;
+}
+
+void PubSubClient::disconnect()
+{
+	const uint8_t packet[] = { MQTTDISCONNECT, 0 };
+	_client->write(packet, sizeof(packet));
+	_state = MQTT_DISCONNECTED;
+	_client->stop();
+}
+
+bool PubSubClient::publish(const char * topic, const uint8_t * payload, unsigned int length, bool retained)
+{
+	if (!connected() || 5 + 2 + strlen(topic) + length > MQTT_MAX_PACKET_SIZE)
+		return false;
+	writeHeader(MQTTPUBLISH | (retained ? 1 : 0), 2 + strlen(topic) + length);
+	writeString(topic);
+	return _client->write(payload, length) == length;
+}
+
+bool PubSubClient::beginPublish(const char * topic, unsigned int length, bool retained)
+{
+	if (!connected())
+		return false;
+	writeHeader(MQTTPUBLISH | (retained ? 1 : 0), 2 + strlen(topic) + length);
+	writeString(topic);
+	return true;
+}
+
+bool PubSubClient::subscribe(const char * topic)
+{
+	if (!connected())
+		return false;
+	nextMsgId = nextMsgId == 0xffff ? 1 : nextMsgId + 1;
+	writeHeader(MQTTSUBSCRIBE | 2, 2 + 2 + strlen(topic) + 1);
+	const uint8_t packetId[] = { (uint8_t)(nextMsgId >> 8), (uint8_t)nextMsgId };
+	_client->write(packetId, sizeof(packetId));
+	writeString(topic);
+	return _client->write((uint8_t)0) == 1;
+}
+
+bool PubSubClient::loop()
+{
+	if (!connected())
+		return false;
+	if (!_client->available())
+		return true;
+
+	//one packet per call. A PUBLISH goes to the callback, a PINGREQ is answered, the rest is dropped
+	uint32_t length = readPacket();
+	if (!length)
+		return connected();
+	uint8_t type = buffer[0] & 0xf0;
+	if (type == MQTTPUBLISH && callback)
+	{
+		//the topic is terminated in place, like PubSubClient does, by moving it one byte down
+		size_t headerLength = 1;
+		while (buffer[headerLength++] & 0x80) {}
+		uint16_t topicLength = buffer[headerLength] << 8 | buffer[headerLength + 1];
+		char * topic = reinterpret_cast<char*>(buffer + headerLength + 1);
+		memmove(topic, topic + 1, topicLength);
+		topic[topicLength] = 0;
+		size_t payloadStart = headerLength + 2 + topicLength + ((buffer[0] & 0x06) ? 2 : 0);
+		callback(topic, buffer + payloadStart, length - payloadStart);
+	}
+	else if (type == MQTTPINGREQ)
+	{
+		const uint8_t packet[] = { MQTTPINGRESP, 0 };
+		_client->write(packet, sizeof(packet));
+	}
+	return true;
+}
+
+bool PubSubClient::connected()
+{
+	if (_client->connected())
+		return _state == MQTT_CONNECTED;
+	if (_state == MQTT_CONNECTED)
+	{
+		_state = MQTT_CONNECTION_LOST;
+		_client->stop();
+	}
+	return false;
+}
+
+bool PubSubClient::readByte(uint8_t * result)
+{
+	//waits for the byte up to the socket timeout
+	unsigned long start = millis();
+	while (!_client->available())
+	{
+		if (millis() - start >= socketTimeout * 1000UL)
+			return false;
+		hostAdvanceMillis(1);
+		waitedMs++;
+	}
+	*result = _client->read();
+	return true;
+}
+
+uint32_t PubSubClient::readPacket()
+{
+	//fixed header, remaining length, the rest. Bytes that do not fit the buffer are read and dropped
+	uint32_t length = 0;
+	if (!readByte(&buffer[length++]))
+		return 0;
+	uint32_t remaining = 0;
+	uint32_t multiplier = 1;
+	uint8_t digit;
+	do
+	{
+		if (length == 5 || !readByte(&digit))
+			return 0;
+		buffer[length++] = digit;
+		remaining += (digit & 0x7f) * multiplier;
+		multiplier <<= 7;
+	} while (digit & 0x80);
+	for (uint32_t cnt = 0; cnt < remaining; cnt++)
+	{
+		if (!readByte(&digit))
+			return 0;
+		if (length < MQTT_MAX_PACKET_SIZE)
+			buffer[length] = digit;
+		length++;
+	}
+	return length <= MQTT_MAX_PACKET_SIZE ? length : 0;
+}
+
+size_t PubSubClient::writeHeader(uint8_t header, size_t remaining)
+{
+	uint8_t packet[5];
+	size_t length = 0;
+	packet[length++] = header;
+	do
+	{
+		packet[length++] = (remaining & 0x7f) | (remaining > 0x7f ? 0x80 : 0);
+		remaining >>= 7;
+	} while (remaining);
+	return _client->write(packet, length);
+}
+
+void PubSubClient::writeString(const char * text)
+{
+	size_t length = strlen(text);
+	const uint8_t lengthBytes[] = { (uint8_t)(length >> 8), (uint8_t)length };
+	_client->write(lengthBytes, sizeof(lengthBytes));
+	_client->write(reinterpret_cast<const uint8_t*>(text), length);
+}
@@ -0,0 +1,68 @@
+// Stand-in for PubSubClient 2.8 that writes the same MQTT packets to the client and reads the
+// same way: connect() waits for the CONNACK and loop() reads one packet, waiting for the rest of
+// it up to the socket timeout. Waiting advances the simulated clock, hostPubSubWaitedMs() adds it up.
+#pragma once
+#include "Client.h"
+
+#define MQTT_MAX_PACKET_SIZE 256
+#define MQTT_KEEPALIVE 15
+#define MQTT_SOCKET_TIMEOUT 15
+
+#define MQTT_CONNECTION_TIMEOUT     -4
+#define MQTT_CONNECTION_LOST        -3
+#define MQTT_CONNECT_FAILED         -2
+#define MQTT_DISCONNECTED           -1
+#define MQTT_CONNECTED               0
+
+#define MQTTCONNECT     1 << 4
+#define MQTTPUBLISH     3 << 4
+#define MQTTPUBACK      4 << 4
+#define MQTTSUBSCRIBE   8 << 4
+#define MQTTPINGREQ     12 << 4
+#define MQTTPINGRESP    13 << 4
+#define MQTTDISCONNECT  14 << 4
+
+#define MQTT_CALLBACK_SIGNATURE std::function<void(char*, uint8_t*, unsigned int)> callback
+
+class PubSubClient : public Print
+{
+public:
+	PubSubClient(Client & client) : _client(&client) {}
+
+	PubSubClient & setServer(const char * domain, uint16_t port) { return *this; }
+	PubSubClient & setCallback(MQTT_CALLBACK_SIGNATURE) { this->callback = callback; return *this; }
+	PubSubClient & setSocketTimeout(uint16_t timeout) { socketTimeout = timeout; return *this; }
+
+	bool connect(const char * id) { return connect(id, nullptr, nullptr); }
+	bool connect(const char * id, const char * user, const char * pass);
+	void disconnect();
+
+	bool publish(const char * topic, const char * payload) { return publish(topic, reinterpret_cast<const uint8_t*>(payload), strlen(payload), false); }
+	bool publish(const char * topic, const char * payload, bool retained) { return publish(topic, reinterpret_cast<const uint8_t*>(payload), strlen(payload), retained); }
+	bool publish(const char * topic, const uint8_t * payload, unsigned int length, bool retained = false);
+	bool beginPublish(const char * topic, unsigned int length, bool retained);
+	int endPublish() { return 1; }
+	size_t write(uint8_t c) override { return _client->write(c); }
+	size_t write(const uint8_t * buffer, size_t size) override { return _client->write(buffer, size); }
+	using Print::write;
+
+	bool subscribe(const char * topic);
+	bool loop();
+	bool connected();
+	int state() { return _state; }
+
+private:
+	bool readByte(uint8_t * result);
+	uint32_t readPacket();
+	size_t writeHeader(uint8_t header, size_t remaining);
+	void writeString(const char * text);
+
+	Client * _client;
+	uint8_t buffer[MQTT_MAX_PACKET_SIZE];
+	uint16_t nextMsgId = 0;
+	uint16_t socketTimeout = MQTT_SOCKET_TIMEOUT;
+	int _state = MQTT_DISCONNECTED;
+	MQTT_CALLBACK_SIGNATURE;
+};
+
+unsigned long hostPubSubWaitedMs();
@@ -0,0 +1,11 @@
+#pragma once
+#include "Arduino.h"
+
+// never running, the debug output goes to Serial
+class RemoteDebug : public Print
+{
+public:
+	bool isRunning() { return false; }
+	size_t write(uint8_t c) override { return 1; }
+	using Print::write;
+};
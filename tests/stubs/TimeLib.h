@@ -0,0 +1,11 @@
+#pragma once
+#include "Arduino.h"
+#include <ctime>
+
+enum timeStatus_t { timeNotSet, timeNeedsSync, timeSet };
+
+// unix time, counting from the time set with hostSetTime at millis() then
+time_t now();
+timeStatus_t timeStatus();
+void hostSetTime(time_t time);
+void hostClearTime();
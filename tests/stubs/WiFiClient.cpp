@@ -0,0 +1,59 @@
+#include "WiFiClient.h"
+#include <algorithm>
+
+bool hostRefuseConnections = false;
+
+std::vector<WiFiClient*> & hostClients()
+{
+	static std::vector<WiFiClient*> clients;
+	return clients;
+}
+
+WiFiClient::WiFiClient()
+{
+	tx.reserve(1 << 16);
+	hostClients().push_back(this);
+}
+
+WiFiClient::~WiFiClient()
+{
+	auto & clients = hostClients();
+	clients.erase(std::find(clients.begin(), clients.end(), this));
+}
+
+int WiFiClient::connect(IPAddress ip, uint16_t port)
+{
+	connects++;
+	rx.clear();
+	open = !hostRefuseConnections;
+	return open;
+}
+
+int WiFiClient::connect(const char * host, uint16_t port)
+{
+	return connect(IPAddress(), port);
+}
+
+int WiFiClient::read()
+{
+	if (!available())
+		return -1;
+	int c = rx.front();
+	rx.pop_front();
+	return c;
+}
+
+size_t WiFiClient::peekBytes(uint8_t * buffer, size_t length)
+{
+	length = min(length, (size_t)available());
+	std::copy(rx.begin(), rx.begin() + length, buffer);
+	return length;
+}
+
+size_t WiFiClient::write(const uint8_t * buffer, size_t size)
+{
+	if (!open)
+		return 0;
+	tx.insert(tx.end(), buffer, buffer + size);
+	return size;
+}
@@ -0,0 +1,38 @@
+// In-memory tcp connection. The test plays the server: it takes what was sent from tx and puts
+// the answers in rx. Every client is listed in hostClients(), in the order they were created.
+#pragma once
+#include "Client.h"
+#include <deque>
+#include <vector>
+
+class WiFiClient : public Client
+{
+public:
+	WiFiClient();
+	WiFiClient(const WiFiClient &) = delete;
+	~WiFiClient();
+
+	int connect(IPAddress ip, uint16_t port) override;
+	int connect(const char * host, uint16_t port) override;
+	uint8_t connected() override { return open; }
+	void stop() override { open = false; }
+	void setTimeout(unsigned long timeout) {}
+	void setNoDelay(bool noDelay) {}
+
+	int available() override { return open ? rx.size() : 0; }
+	int read() override;
+	int peek() override { return available() ? rx.front() : -1; }
+	size_t peekBytes(uint8_t * buffer, size_t length);
+	size_t write(uint8_t c) override { return write(&c, 1); }
+	size_t write(const uint8_t * buffer, size_t size) override;
+	using Print::write;
+
+	std::deque<uint8_t> rx;		//received from the server, not read yet
+	std::vector<uint8_t> tx;	//sent to the server. Reserved, so writing does not allocate
+	bool open = false;
+	int connects = 0;
+};
+
+std::vector<WiFiClient*> & hostClients();
+// connect() fails while set
+extern bool hostRefuseConnections;
@@ -0,0 +1,16 @@
+// The one ESP8266 SDK GPIO register access the software serial ISRs use: clearing the latched
+// interrupt status of a pin, see hostQueuePin() in ArduinoHost.h.
+#pragma once
+#include <stdint.h>
+
+#define GPIO_STATUS_W1TC_ADDRESS 0x24
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+void hostGpioRegWrite(uint32_t address, uint32_t value);
+#ifdef __cplusplus
+}
+#endif
+
+#define GPIO_REG_WRITE(reg, val) hostGpioRegWrite(reg, val)
@@ -0,0 +1,64 @@
+// Minimal test runner for the host tests: TEST cases are registered statically and run by
+// runTests(), CHECK failures are reported with file and line, the exit code is the failure count.
+#pragma once
+#include <cstdio>
+#include <functional>
+#include <vector>
+
+struct TestCase
+{
+	const char * name;
+	std::function<void()> run;
+};
+
+inline std::vector<TestCase> & testCases()
+{
+	static std::vector<TestCase> cases;
+	return cases;
+}
+
+inline int & testFailures()
+{
+	static int failures = 0;
+	return failures;
+}
+
+struct TestRegistration
+{
+	TestRegistration(const char * name, std::function<void()> run) { testCases().push_back({ name, run }); }
+};
+
+#define TEST(name) \
+	static void name(); \
+	static TestRegistration name##Registration(#name, name); \
+	static void name()
+
+#define CHECK(condition) \
+	do { \
+		if (!(condition)) { \
+			printf("%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #condition); \
+			testFailures()++; \
+		} \
+	} while (0)
+
+#define CHECK_EQUAL(expected, actual) \
+	do { \
+		auto checkExpected = (expected); \
+		auto checkActual = (actual); \
+		if (!(checkExpected == checkActual)) { \
+			printf("%s:%d: CHECK_EQUAL failed: %s == %s (%lld vs %lld)\n", __FILE__, __LINE__, #expected, #actual, \
+				(long long)checkExpected, (long long)checkActual); \
+			testFailures()++; \
+		} \
+	} while (0)
+
+inline int runTests()
+{
+	for (auto & test : testCases())
+	{
+		int failuresBefore = testFailures();
+		test.run();
+		printf("%s %s\n", testFailures() == failuresBefore ? "PASS" : "FAIL", test.name);
+	}
+	return testFailures();
+}
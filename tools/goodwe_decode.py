@@ -0,0 +1,84 @@
+#!/usr/bin/env python3
+# Decoder for the binary MQTT samples of the GoodWe logger (MQTT_BINARY_MODE).
+#
+# Read the samples from the broker with mosquitto_sub and pipe them through this script:
+#   mosquitto_sub -h <broker> -t 'goodwe/+/bin' -F '%t %x' | python3 goodwe_decode.py
+# Every sample is printed as a json line. Or import it and call decode(payload) on the raw bytes.
+
+import json
+import struct
+import sys
+
+# the field table of MQTTPublisher.cpp per schema version: (name, decimals)
+FIELDS = {
+    1: [
+        ("online", 0), ("vpv1", 1), ("vpv2", 1), ("ipv1", 1), ("ipv2", 1), ("vac1", 1), ("iac1", 1),
+        ("fac1", 2), ("pac", 0), ("temp", 1), ("vac2", 1), ("iac2", 1), ("fac2", 2), ("vac3", 1),
+        ("iac3", 1), ("fac3", 2), ("workmode", 0), ("eday", 2),
+    ],
+}
+# version 2 added the rest of the inverter record
+FIELDS[2] = FIELDS[1] + [
+    ("errormessage", 0), ("etotal", 1), ("htotal", 0), ("tempfault", 1), ("pv1fault", 1), ("pv2fault", 1),
+    ("line1vfault", 1), ("line1ffault", 2), ("gcfifault", 0), ("line2vfault", 1), ("line3vfault", 1),
+    ("line2ffault", 2), ("line3ffault", 2),
+]
+
+
+def _unpack(data, pos):
+    # the part of MessagePack the logger writes: integers, nil and an array16
+    tag = data[pos]
+    if tag <= 0x7f:
+        return tag, pos + 1
+    if tag >= 0xe0:
+        return tag - 0x100, pos + 1
+    if tag == 0xc0:
+        return None, pos + 1
+    formats = {0xcc: ">B", 0xcd: ">H", 0xce: ">I", 0xd0: ">b", 0xd1: ">h", 0xd2: ">i"}
+    if tag in formats:
+        value, = struct.unpack_from(formats[tag], data, pos + 1)
+        return value, pos + 1 + struct.calcsize(formats[tag])
+    if tag == 0xdc or 0x90 <= tag <= 0x9f:
+        if tag == 0xdc:
+            count, = struct.unpack_from(">H", data, pos + 1)
+            pos += 3
+        else:
+            count = tag & 0x0f
+            pos += 1
+        items = []
+        for _ in range(count):
+            item, pos = _unpack(data, pos)
+            items.append(item)
+        return items, pos
+    raise ValueError("unsupported MessagePack type 0x%02x" % tag)
+
+
+def decode(payload):
+    """Decode a binary sample into a dict of the field values. Fields the inverter does not have are left out.
+    'ts' is the unix time of the sample, or 'age' its age in seconds when the logger clock was not set."""
+    items, _ = _unpack(bytes(payload), 0)
+    version, time, values = items[0], items[1], items[2:]
+    if version not in FIELDS:
+        raise ValueError("unknown schema version %d" % version)
+    sample = {"ts": time} if time > 0 else {"age": -time}
+    for (name, decimals), value in zip(FIELDS[version], values):
+        if value is not None:
+            sample[name] = value / 10 ** decimals if decimals else value
+    return sample
+
+
+def main():
+    for line in sys.stdin:
+        topic, _, payload = line.strip().rpartition(" ")
+        try:
+            sample = decode(bytes.fromhex(payload))
+        except ValueError as error:
+            print("%s: %s" % (topic, error), file=sys.stderr)
+            continue
+        sample["serial"] = topic.split("/")[1] if topic else ""
+        print(json.dumps(sample))
+        sys.stdout.flush()
+
+
+if __name__ == "__main__":
+    main()